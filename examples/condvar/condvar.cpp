@@ -0,0 +1,107 @@
+// condvar.cpp
+// This example uses CoopConditionVariable and CoopEvent on host builds.
+// Workers wait on a manual-reset start event, that releases all of them at once.
+// Producers and consumers share a bounded queue, which is guarded by a CoopMutex, and wait
+// on condition variables for it to become not full or not empty.
+// An OS thread sets an auto-reset event periodically, a task counts these ticks,
+// and the producers stop after a number of them.
+
+#include <iostream>
+#include <deque>
+#include <thread>
+#include <chrono>
+#include "CoopTask.h"
+#include "CoopConditionVariable.h"
+#include "CoopEvent.h"
+
+namespace
+{
+    constexpr int PRODUCERS = 4;
+    constexpr int CONSUMERS = 4;
+    constexpr size_t QUEUESIZE = 16;
+    constexpr int TICKS = 50;
+    constexpr size_t TASKSTACKSIZE = 0x4000;
+
+    CoopEvent start;
+    CoopEvent tick(true);
+    CoopMutex queueMutex;
+    CoopConditionVariable notFull;
+    CoopConditionVariable notEmpty;
+    std::deque<int> queue;
+    bool stopping = false;
+    int producersLeft = PRODUCERS;
+}
+
+int main()
+{
+    long produced = 0;
+    long consumed = 0;
+    for (int i = 0; i < PRODUCERS; ++i)
+    {
+        auto producer = createCoopTask<void>(std::string("producer"), [&]() noexcept
+            {
+                if (!start.wait()) std::cerr << "start.wait() failed" << std::endl;
+                for (int item = 1;; ++item)
+                {
+                    CoopMutexLock lock(queueMutex);
+                    notFull.wait(queueMutex, []() { return stopping || queue.size() < QUEUESIZE; });
+                    if (stopping) break;
+                    queue.push_back(item);
+                    ++produced;
+                    notEmpty.notify_one();
+                }
+                CoopMutexLock lock(queueMutex);
+                // the consumers that wait for the queue to fill up see that no more items come
+                if (!--producersLeft) notEmpty.notify_all();
+            }, TASKSTACKSIZE);
+        if (!producer) std::cerr << "CoopTask producer not created" << std::endl;
+    }
+    for (int i = 0; i < CONSUMERS; ++i)
+    {
+        auto consumer = createCoopTask<void>(std::string("consumer"), [&]() noexcept
+            {
+                if (!start.wait()) std::cerr << "start.wait() failed" << std::endl;
+                for (;;)
+                {
+                    CoopMutexLock lock(queueMutex);
+                    notEmpty.wait(queueMutex, []() { return !producersLeft || !queue.empty(); });
+                    if (queue.empty()) break;
+                    ++consumed;
+                    queue.pop_front();
+                    notFull.notify_one();
+                }
+            }, TASKSTACKSIZE);
+        if (!consumer) std::cerr << "CoopTask consumer not created" << std::endl;
+    }
+    auto counter = createCoopTask<void>(std::string("ticks"), []() noexcept
+        {
+            if (!start.wait()) std::cerr << "start.wait() failed" << std::endl;
+            int ticks = 0;
+            while (ticks < TICKS)
+            {
+                if (tick.wait(100)) ++ticks;
+                else std::cerr << "tick.wait() timed out" << std::endl;
+            }
+            CoopMutexLock lock(queueMutex);
+            stopping = true;
+            notFull.notify_all();
+        }, TASKSTACKSIZE);
+    if (!counter) std::cerr << "CoopTask ticks not created" << std::endl;
+
+    std::thread ticker([]()
+        {
+            for (int i = 0; i < TICKS; ++i)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                tick.set();
+            }
+        });
+    start.set();
+    while (CoopScheduler::defaultScheduler().getRunnableTasksCount())
+    {
+        runCoopTasks([](const CoopTaskBase* const task) { delete task; });
+    }
+    ticker.join();
+    std::cerr << "produced " << produced << " items, consumed " << consumed << std::endl;
+    return 0;
+}
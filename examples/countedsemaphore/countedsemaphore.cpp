@@ -0,0 +1,92 @@
+// countedsemaphore.cpp
+// This example passes values through a ring buffer in batches, on host builds.
+// One semaphore counts the free slots, another the filled ones. Producers acquire the
+// free slots for a whole batch by acquire(count), and make it available by a single
+// post(count), consumers take as many filled slots at once. A consumer that waits for
+// a larger batch is not overtaken by consumers that wait for fewer slots.
+
+#include <iostream>
+#include "CoopTask.h"
+#include "CoopSemaphore.h"
+
+namespace
+{
+    constexpr unsigned SLOTS = 64;
+    constexpr int PRODUCERS = 4;
+    constexpr int BATCHES = 1000;
+    constexpr unsigned CONSUMERBATCH[] = { 1, 5, 16 };
+    constexpr size_t TASKSTACKSIZE = 0x4000;
+
+    uint32_t ring[SLOTS];
+    unsigned head = 0;
+    unsigned tail = 0;
+    CoopSemaphore freeSlots(SLOTS);
+    CoopSemaphore filledSlots(0);
+}
+
+int main()
+{
+    uint64_t produced = 0;
+    uint64_t consumed = 0;
+    int producing = PRODUCERS;
+    for (int i = 0; i < PRODUCERS; ++i)
+    {
+        auto producer = createCoopTask<void>(std::string("producer"), [&, i]() noexcept
+            {
+                for (int batch = 0; batch < BATCHES; ++batch)
+                {
+                    const unsigned count = 1 + (batch + i) % 8;
+                    if (!freeSlots.acquire(count)) std::cerr << "freeSlots.acquire() failed" << std::endl;
+                    for (unsigned n = 0; n < count; ++n)
+                    {
+                        ring[head++ % SLOTS] = batch;
+                        produced += batch;
+                    }
+                    filledSlots.post(count);
+                    yield();
+                }
+                --producing;
+            }, TASKSTACKSIZE);
+        if (!producer) std::cerr << "CoopTask producer not created" << std::endl;
+    }
+    constexpr int CONSUMERS = sizeof(CONSUMERBATCH) / sizeof(CONSUMERBATCH[0]);
+    int taken[CONSUMERS] = {};
+    for (int i = 0; i < CONSUMERS; ++i)
+    {
+        const unsigned count = CONSUMERBATCH[i];
+        auto consumer = createCoopTask<void>(std::string("consumer"), [&, i, count]() noexcept
+            {
+                for (;;)
+                {
+                    // ends once the producers are done, and no full batch is left after a while
+                    if (!filledSlots.acquire(count, 10))
+                    {
+                        if (producing) continue;
+                        break;
+                    }
+                    for (unsigned n = 0; n < count; ++n)
+                    {
+                        consumed += ring[tail++ % SLOTS];
+                    }
+                    freeSlots.post(count);
+                    ++taken[i];
+                }
+            }, TASKSTACKSIZE);
+        if (!consumer) std::cerr << "CoopTask consumer not created" << std::endl;
+    }
+    while (CoopScheduler::defaultScheduler().getRunnableTasksCount())
+    {
+        runCoopTasks([](const CoopTaskBase* const task) { delete task; });
+    }
+    // the remainder that no consumer took as a full batch
+    while (filledSlots.try_wait())
+    {
+        consumed += ring[tail++ % SLOTS];
+    }
+    for (int i = 0; i < CONSUMERS; ++i)
+    {
+        std::cerr << "consumer of " << CONSUMERBATCH[i] << " slots took " << taken[i] << " batches" << std::endl;
+    }
+    std::cerr << "produced " << produced << ", consumed " << consumed << std::endl;
+    return 0;
+}
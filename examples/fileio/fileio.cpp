@@ -0,0 +1,94 @@
+// fileio.cpp
+// This is a benchmark of CoopTask<>::coopWrite() and coopFsync() on Linux host builds.
+// Many tasks append log records to their own files and flush them to storage, while a
+// heartbeat task measures how late its 1 ms delays expire. The file operations are
+// submitted to io_uring, such that slow storage does not stall the other tasks.
+
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "CoopTask.h"
+
+namespace
+{
+    using clock = std::chrono::steady_clock;
+
+    constexpr int LOGGERS = 100;
+    constexpr int RECORDS = 1000;
+    constexpr int RECORDSPERSYNC = 100;
+    constexpr size_t TASKSTACKSIZE = 0x2000;
+
+    int finished = 0;
+    int failed = 0;
+
+    void logRecords(int fd, int logger)
+    {
+        char record[128];
+        for (int i = 0; i < RECORDS; ++i)
+        {
+            const int length = snprintf(record, sizeof(record), "logger %d record %d\n", logger, i);
+            if (CoopTask<void>::coopWrite(fd, record, length) != length ||
+                ((i + 1) % RECORDSPERSYNC == 0 && CoopTask<void>::coopFsync(fd) != 0))
+            {
+                ++failed;
+                break;
+            }
+        }
+        ++finished;
+    }
+}
+
+int main()
+{
+    std::vector<std::string> paths;
+    std::vector<int> fds;
+    for (int i = 0; i < LOGGERS; ++i)
+    {
+        paths.push_back("fileio." + std::to_string(i) + ".log");
+        const int fd = open(paths.back().c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+        if (fd < 0 || !createCoopTask<void>(std::string("logger"), [fd, i]() noexcept { logRecords(fd, i); }, TASKSTACKSIZE))
+        {
+            std::cerr << "logger " << i << " not created" << std::endl;
+            return 1;
+        }
+        fds.push_back(fd);
+    }
+
+    double maxLateMs = 0;
+    auto heartbeat = createCoopTask<void>(std::string("heartbeat"), [&maxLateMs]() noexcept
+        {
+            while (finished < LOGGERS)
+            {
+                const auto start = clock::now();
+                CoopTask<void>::delay(1);
+                const auto lateMs = std::chrono::duration<double, std::milli>(clock::now() - start).count() - 1;
+                if (lateMs > maxLateMs) maxLateMs = lateMs;
+            }
+        }, TASKSTACKSIZE);
+    if (!heartbeat)
+    {
+        std::cerr << "CoopTask heartbeat not created" << std::endl;
+        return 1;
+    }
+
+    // block in epoll_wait() while all tasks wait
+    CoopScheduler::defaultScheduler().setIdleBlocking(true);
+    const auto start = clock::now();
+    while (CoopScheduler::defaultScheduler().getRunnableTasksCount())
+    {
+        runCoopTasks([](const CoopTaskBase* const task) { delete task; });
+    }
+    const auto ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    for (int i = 0; i < LOGGERS; ++i)
+    {
+        close(fds[i]);
+        unlink(paths[i].c_str());
+    }
+    std::cerr << LOGGERS * RECORDS << " records in " << ms << " ms, max heartbeat lateness " << maxLateMs
+        << " ms, failed " << failed << std::endl;
+    return 0;
+}
@@ -0,0 +1,66 @@
+// handoff.cpp
+// This is a benchmark of CoopSemaphore::handoff() on host builds.
+// Two tasks play ping-pong on a pair of semaphores, among a number of idle bystander tasks.
+// With post(), each woken task waits for its turn in the next scheduler pass,
+// with handoff(), the CPU switches directly to the woken task.
+
+#include <iostream>
+#include <chrono>
+#include "CoopTask.h"
+#include "CoopSemaphore.h"
+
+namespace
+{
+    constexpr int ROUNDS = 200000;
+    constexpr int BYSTANDERS = 50;
+    constexpr size_t TASKSTACKSIZE = 0x2000;
+
+    double nsPerRound(bool useHandoff)
+    {
+        CoopSemaphore ping(0);
+        CoopSemaphore pong(0);
+        bool done = false;
+        auto signal = [useHandoff](CoopSemaphore& sema) { if (useHandoff) sema.handoff(); else sema.post(); };
+        auto pinger = createCoopTask<void>(std::string("pinger"), [&]() noexcept
+            {
+                for (int i = 0; i < ROUNDS; ++i)
+                {
+                    signal(ping);
+                    pong.wait();
+                }
+                done = true;
+            }, TASKSTACKSIZE);
+        if (!pinger) std::cerr << "CoopTask pinger not created" << std::endl;
+        auto ponger = createCoopTask<void>(std::string("ponger"), [&]() noexcept
+            {
+                for (int i = 0; i < ROUNDS; ++i)
+                {
+                    ping.wait();
+                    signal(pong);
+                }
+            }, TASKSTACKSIZE);
+        if (!ponger) std::cerr << "CoopTask ponger not created" << std::endl;
+        for (int i = 0; i < BYSTANDERS; ++i)
+        {
+            auto bystander = createCoopTask<void>(std::string("bystander"), [&done]() noexcept
+                {
+                    while (!done) yield();
+                }, TASKSTACKSIZE);
+            if (!bystander) std::cerr << "CoopTask bystander not created" << std::endl;
+        }
+        const Delegate<void(const CoopTaskBase* const task)> reaper = [](const CoopTaskBase* const task) { delete task; };
+        const auto start = std::chrono::steady_clock::now();
+        while (CoopScheduler::defaultScheduler().getRunnableTasksCount())
+        {
+            runCoopTasks(reaper);
+        }
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / ROUNDS;
+    }
+}
+
+int main()
+{
+    std::cerr << "post(): " << nsPerRound(false) << " ns per round" << std::endl;
+    std::cerr << "handoff(): " << nsPerRound(true) << " ns per round" << std::endl;
+    return 0;
+}
@@ -0,0 +1,76 @@
+// pooledtasks.cpp
+// This is a benchmark of task creation from a pool on host builds.
+// Batches of short-lived tasks are created, run to completion, and deleted by the reaper.
+// createPooledCoopTask() draws the task objects from a pool of POOLSIZE objects, and with
+// CoopTaskStackAllocatorPool, a plain function, and a short name, no heap allocation is left.
+// Once the pool is exhausted, createPooledCoopTask() returns nullptr.
+// makeCoopTask() keeps a capturing lambda by its type in an InlineCoopTask, instead of
+// in a Delegate, and calls it directly.
+
+#include <iostream>
+#include <chrono>
+#include "CoopTask.h"
+
+namespace
+{
+    constexpr int BATCHES = 200;
+    constexpr size_t POOLSIZE = 100;
+    constexpr size_t TASKSTACKSIZE = 0x4000;
+
+    using StackAllocator = CoopTaskStackAllocatorPool<POOLSIZE>;
+
+    int shortTask() noexcept
+    {
+        yield();
+        return 0;
+    }
+
+    const Delegate<void(const CoopTaskBase* const task)> reaper = [](const CoopTaskBase* const task) { delete task; };
+
+    template<typename Create> double usPerTask(Create create)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        for (int batch = 0; batch < BATCHES; ++batch)
+        {
+            for (size_t i = 0; i < POOLSIZE; ++i)
+            {
+                if (!create()) std::cerr << "CoopTask not created" << std::endl;
+            }
+            while (CoopScheduler::defaultScheduler().getRunnableTasksCount())
+            {
+                runCoopTasks(reaper);
+            }
+        }
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / (BATCHES * POOLSIZE);
+    }
+}
+
+int main()
+{
+    std::cerr << "createCoopTask(): " << usPerTask([]()
+        {
+            return createCoopTask<int, StackAllocator>(std::string("short"), shortTask, TASKSTACKSIZE);
+        }) << " us per task" << std::endl;
+    std::cerr << "createPooledCoopTask(): " << usPerTask([]()
+        {
+            return createPooledCoopTask<POOLSIZE, int, StackAllocator>(std::string("short"), shortTask, TASKSTACKSIZE, 1);
+        }) << " us per task" << std::endl;
+    int finished = 0;
+    std::cerr << "makeCoopTask(): " << usPerTask([&finished]()
+        {
+            return makeCoopTask<StackAllocator>(std::string("short"), [&finished]() noexcept
+                {
+                    yield();
+                    ++finished;
+                }, TASKSTACKSIZE);
+        }) << " us per task" << std::endl;
+
+    size_t created = 0;
+    while (createPooledCoopTask<POOLSIZE, int, StackAllocator>(std::string("short"), shortTask, TASKSTACKSIZE)) ++created;
+    std::cerr << "the pool is exhausted after " << created << " tasks" << std::endl;
+    while (CoopScheduler::defaultScheduler().getRunnableTasksCount())
+    {
+        runCoopTasks(reaper);
+    }
+    return 0;
+}
@@ -88,6 +88,8 @@ int main()
         }
     };
 
+    // this loop does nothing else, block while all tasks are delayed
+    CoopScheduler::defaultScheduler().setIdleBlocking(true);
     for (;;)
     {
         runCoopTasks(taskReaper);
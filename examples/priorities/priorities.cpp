@@ -0,0 +1,122 @@
+// priorities.cpp
+// This example measures how late a periodic control task runs among many busy bulk tasks,
+// on host builds. At the default priority, the control task waits for all bulk tasks
+// that are ahead of it in the scheduler pass. At a higher priority, it runs once its
+// period expires, after the single bulk task that is running at that time.
+// Among tasks of the same priority, earliest-deadline-first ordering lets a task with a short
+// period and a tight deadline run ahead of periodic tasks with long periods and more work,
+// whose periods expire at the same time.
+
+#include <iostream>
+#include "CoopTask.h"
+
+namespace
+{
+    constexpr int BULKTASKS = 200;
+    constexpr int PERIODS = 100;
+    constexpr uint32_t PERIOD_MS = 10;
+    constexpr size_t TASKSTACKSIZE = 0x4000;
+    constexpr int SLOWTASKS = 8;
+    constexpr uint32_t FASTPERIOD_MS = 5;
+    constexpr uint32_t SLOWPERIOD_MS = 20;
+
+    // runs busy for about us microseconds
+    void work(uint32_t us)
+    {
+        const auto start = CoopTaskBase::clockNow();
+        while (CoopTaskBase::clockNow() - start < us) {}
+    }
+
+    const Delegate<void(const CoopTaskBase* const task)> reaper = [](const CoopTaskBase* const task) { delete task; };
+
+    // @returns: the maximum lateness of the control task in microseconds
+    uint64_t maxLateness(uint8_t controlPriority)
+    {
+        bool done = false;
+        uint64_t maxLate = 0;
+        auto control = createCoopTask<void>(std::string("control"), [&]() noexcept
+            {
+                uint32_t next = static_cast<uint32_t>(CoopTaskBase::clockNow() / 1000);
+                for (int i = 0; i < PERIODS; ++i)
+                {
+                    next += PERIOD_MS;
+                    CoopTask<void>::delayUntil(next);
+                    const uint64_t now = CoopTaskBase::clockNow();
+                    const uint64_t due = next * uint64_t(1000);
+                    if (now > due && now - due > maxLate) maxLate = now - due;
+                }
+                done = true;
+            }, TASKSTACKSIZE, controlPriority);
+        if (!control) std::cerr << "CoopTask control not created" << std::endl;
+        for (int i = 0; i < BULKTASKS; ++i)
+        {
+            auto bulk = createCoopTask<void>(std::string("bulk"), [&done]() noexcept
+                {
+                    while (!done)
+                    {
+                        work(20);
+                        yield();
+                    }
+                }, TASKSTACKSIZE);
+            if (!bulk) std::cerr << "CoopTask bulk not created" << std::endl;
+        }
+        while (CoopScheduler::defaultScheduler().getRunnableTasksCount())
+        {
+            runCoopTasks(reaper);
+        }
+        return maxLate;
+    }
+
+    // @returns: the count of periods in which the fast task missed its deadline
+    int deadlineMisses(bool edf)
+    {
+        CoopScheduler::defaultScheduler().setEarliestDeadlineFirst(edf);
+        // all periods start at the same time
+        const uint32_t start = static_cast<uint32_t>(CoopTaskBase::clockNow() / 1000) + 2;
+        bool done = false;
+        int misses = 0;
+        for (int i = 0; i < SLOWTASKS; ++i)
+        {
+            auto slow = createCoopTask<void>(std::string("slow"), [&done, start]() noexcept
+                {
+                    uint32_t next = start;
+                    while (!done)
+                    {
+                        CoopTask<void>::self()->setDeadline(next + SLOWPERIOD_MS);
+                        CoopTask<void>::delayUntil(next);
+                        work(1000);
+                        next += SLOWPERIOD_MS;
+                    }
+                }, TASKSTACKSIZE, 1);
+            if (!slow) std::cerr << "CoopTask slow not created" << std::endl;
+        }
+        auto fast = createCoopTask<void>(std::string("fast"), [&]() noexcept
+            {
+                uint32_t next = start;
+                for (int i = 0; i < PERIODS; ++i)
+                {
+                    CoopTask<void>::self()->setDeadline(next + 1);
+                    CoopTask<void>::delayUntil(next);
+                    if (CoopTaskBase::clockNow() > (next + 1) * uint64_t(1000)) ++misses;
+                    next += FASTPERIOD_MS;
+                }
+                done = true;
+            }, TASKSTACKSIZE, 1);
+        if (!fast) std::cerr << "CoopTask fast not created" << std::endl;
+        while (CoopScheduler::defaultScheduler().getRunnableTasksCount())
+        {
+            runCoopTasks(reaper);
+        }
+        return misses;
+    }
+}
+
+int main()
+{
+    std::cerr << "control at priority 0: max lateness " << maxLateness(0) << " us" << std::endl;
+    std::cerr << "control at priority " << CoopTaskBase::PRIORITYLEVELS - 1 << ": max lateness " <<
+        maxLateness(CoopTaskBase::PRIORITYLEVELS - 1) << " us" << std::endl;
+    std::cerr << "fast task without EDF: " << deadlineMisses(false) << " of " << PERIODS << " deadlines missed" << std::endl;
+    std::cerr << "fast task with EDF: " << deadlineMisses(true) << " of " << PERIODS << " deadlines missed" << std::endl;
+    return 0;
+}
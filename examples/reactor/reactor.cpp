@@ -0,0 +1,153 @@
+// reactor.cpp
+// This is a benchmark of CoopTask<>::waitReadable() and waitWritable() on Linux host builds.
+// A single thread serves thousands of loopback TCP connections, one task per connection
+// on each end, that exchange short messages. Tasks that find their socket not ready
+// wait for it, the scheduler blocks in epoll_wait() when none is ready.
+
+#include <iostream>
+#include <chrono>
+#include <cerrno>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include "CoopTask.h"
+
+namespace
+{
+    using clock = std::chrono::steady_clock;
+
+    constexpr int CONNECTIONS = 2000;
+    constexpr int ROUNDTRIPS = 100;
+    constexpr size_t TASKSTACKSIZE = 0x2000;
+    constexpr char MESSAGE[] = "0123456789abcdef";
+
+    int served = 0;
+    int failed = 0;
+
+    // reads some bytes, waits while fd has none
+    ssize_t readSome(int fd, char* buf, size_t size)
+    {
+        for (;;)
+        {
+            const auto count = read(fd, buf, size);
+            if (count >= 0 || errno != EAGAIN) return count;
+            CoopTask<void>::waitReadable(fd);
+        }
+    }
+
+    void serve(int fd)
+    {
+        char buf[256];
+        ssize_t count;
+        // loopback sockets take the few bytes of a message without waiting
+        while ((count = readSome(fd, buf, sizeof(buf))) > 0)
+        {
+            if (write(fd, buf, count) != count) break;
+        }
+        close(fd);
+        ++served;
+    }
+
+    void client(const sockaddr_in& addr)
+    {
+        const int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (fd < 0 || (connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) < 0 &&
+            (errno != EINPROGRESS || !CoopTask<void>::waitWritable(fd))))
+        {
+            ++failed;
+            if (fd >= 0) close(fd);
+            return;
+        }
+        char buf[sizeof(MESSAGE)];
+        for (int i = 0; i < ROUNDTRIPS; ++i)
+        {
+            if (write(fd, MESSAGE, sizeof(MESSAGE)) != sizeof(MESSAGE))
+            {
+                ++failed;
+                break;
+            }
+            size_t got = 0;
+            while (got < sizeof(MESSAGE))
+            {
+                const auto count = readSome(fd, buf + got, sizeof(buf) - got);
+                if (count <= 0) break;
+                got += count;
+            }
+            if (got < sizeof(MESSAGE))
+            {
+                ++failed;
+                break;
+            }
+        }
+        close(fd);
+    }
+}
+
+int main()
+{
+    // each connection takes two file descriptors
+    rlimit limit;
+    if (!getrlimit(RLIMIT_NOFILE, &limit))
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    const int listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrLen = sizeof(addr);
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        listen(listener, SOMAXCONN) < 0 || getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &addrLen) < 0)
+    {
+        std::cerr << "listening socket not created" << std::endl;
+        return 1;
+    }
+
+    auto acceptor = createCoopTask<void>(std::string("acceptor"), [listener]() noexcept
+        {
+            for (int accepted = 0; accepted < CONNECTIONS;)
+            {
+                const int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK);
+                if (fd < 0)
+                {
+                    if (errno != EAGAIN || !CoopTask<void>::waitReadable(listener, 5000)) break;
+                    continue;
+                }
+                ++accepted;
+                if (!createCoopTask<void>(std::string("server"), [fd]() noexcept { serve(fd); }, TASKSTACKSIZE))
+                {
+                    close(fd);
+                }
+            }
+        }, TASKSTACKSIZE);
+    if (!acceptor)
+    {
+        std::cerr << "CoopTask acceptor not created" << std::endl;
+        return 1;
+    }
+    for (int i = 0; i < CONNECTIONS; ++i)
+    {
+        if (!createCoopTask<void>(std::string("client"), [&addr]() noexcept { client(addr); }, TASKSTACKSIZE))
+        {
+            std::cerr << "CoopTask client " << i << " not created" << std::endl;
+            ++failed;
+        }
+    }
+
+    // block in epoll_wait() while all tasks wait
+    CoopScheduler::defaultScheduler().setIdleBlocking(true);
+    const auto start = clock::now();
+    while (CoopScheduler::defaultScheduler().getRunnableTasksCount())
+    {
+        runCoopTasks([](const CoopTaskBase* const task) { delete task; });
+    }
+    const auto ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    close(listener);
+    std::cerr << CONNECTIONS << " connections, " << CONNECTIONS * ROUNDTRIPS << " round trips in " << ms << " ms, "
+        << CONNECTIONS * ROUNDTRIPS / ms << " per ms, served " << served << ", failed " << failed << std::endl;
+    return 0;
+}
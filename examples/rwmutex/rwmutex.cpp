@@ -0,0 +1,89 @@
+// rwmutex.cpp
+// This example shares a table between many reader tasks and a few writer tasks, on host builds.
+// Readers hold a CoopSharedLock, and yield while they hold it, such that many of them read at once.
+// Writers hold a CoopExclusiveLock, and update the table in steps with yields in between,
+// a reader must never see a partly updated table. With writer preference, the default,
+// the writers are not starved by the stream of overlapping readers.
+
+#include <iostream>
+#include "CoopTask.h"
+#include "CoopRWMutex.h"
+
+namespace
+{
+    constexpr int READERS = 20;
+    constexpr int WRITERS = 2;
+    constexpr int READS = 500;
+    constexpr int WRITES = 50;
+    constexpr size_t TASKSTACKSIZE = 0x4000;
+
+    CoopRWMutex tableMutex;
+    int table[8] = {};
+}
+
+int main()
+{
+    int readers = 0;
+    int maxReaders = 0;
+    int writes = 0;
+    for (int i = 0; i < READERS; ++i)
+    {
+        auto reader = createCoopTask<void>(std::string("reader"), [&]() noexcept
+            {
+                for (int n = 0; n < READS; ++n)
+                {
+                    CoopSharedLock lock(tableMutex);
+                    if (!lock)
+                    {
+                        std::cerr << "reader not locked" << std::endl;
+                        continue;
+                    }
+                    if (++readers > maxReaders) maxReaders = readers;
+                    const int first = table[0];
+                    yield();
+                    for (const auto entry : table)
+                    {
+                        if (entry != first)
+                        {
+                            std::cerr << "reader saw a partly updated table" << std::endl;
+                            break;
+                        }
+                    }
+                    --readers;
+                }
+            }, TASKSTACKSIZE);
+        if (!reader) std::cerr << "CoopTask reader not created" << std::endl;
+    }
+    for (int i = 0; i < WRITERS; ++i)
+    {
+        auto writer = createCoopTask<void>(std::string("writer"), [&]() noexcept
+            {
+                for (int n = 0; n < WRITES; ++n)
+                {
+                    {
+                        CoopExclusiveLock lock(tableMutex);
+                        if (!lock)
+                        {
+                            std::cerr << "writer not locked" << std::endl;
+                            continue;
+                        }
+                        const int next = table[0] + 1;
+                        for (auto& entry : table)
+                        {
+                            entry = next;
+                            yield();
+                        }
+                        ++writes;
+                    }
+                    CoopTask<void>::delay(1);
+                }
+            }, TASKSTACKSIZE);
+        if (!writer) std::cerr << "CoopTask writer not created" << std::endl;
+    }
+    while (CoopScheduler::defaultScheduler().getRunnableTasksCount())
+    {
+        runCoopTasks([](const CoopTaskBase* const task) { delete task; });
+    }
+    std::cerr << "writes " << writes << ", max concurrent readers " << maxReaders << std::endl;
+    return 0;
+}
@@ -0,0 +1,87 @@
+// scaling.cpp
+// This is a benchmark of the scheduler on host builds.
+// For 1k, 10k and 100k tasks, it measures the cost of a runCoopTasks() pass,
+// first with all tasks yielding, then with all but a few tasks delayed.
+
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include "CoopTask.h"
+
+namespace
+{
+    using clock = std::chrono::steady_clock;
+
+    constexpr size_t TASKSTACKSIZE = 0x1000;
+    constexpr size_t BUSYTASKS = 10;
+    constexpr int PASSES = 20;
+
+    bool stop = false;
+    size_t reaped = 0;
+
+    void reaper(const CoopTaskBase* const task)
+    {
+        ++reaped;
+        delete task;
+    }
+
+    double nsPerPass(int passes)
+    {
+        const auto start = clock::now();
+        for (int i = 0; i < passes; ++i) runCoopTasks(reaper);
+        return std::chrono::duration<double, std::nano>(clock::now() - start).count() / passes;
+    }
+
+    void benchmark(size_t taskCount)
+    {
+        std::vector<CoopTask<void>*> tasks;
+        tasks.reserve(taskCount);
+        stop = false;
+        reaped = 0;
+        bool delaying = false;
+
+        auto start = clock::now();
+        for (size_t i = 0; i < taskCount; ++i)
+        {
+            auto task = createCoopTask<void>(std::string("task"), [i, &delaying]() noexcept
+                {
+                    while (!stop)
+                    {
+                        if (delaying && i >= BUSYTASKS) delay(60000);
+                        else yield();
+                    }
+                }, TASKSTACKSIZE);
+            if (!task)
+            {
+                std::cerr << "CoopTask " << i << " not created" << std::endl;
+                break;
+            }
+            tasks.push_back(task);
+        }
+        const auto createNs = std::chrono::duration<double, std::nano>(clock::now() - start).count() / taskCount;
+        // the first pass initializes each task stack
+        runCoopTasks(reaper);
+
+        const auto yieldingNs = nsPerPass(PASSES);
+        delaying = true;
+        runCoopTasks(reaper);
+        const auto delayedNs = nsPerPass(PASSES * 10);
+
+        std::cerr << taskCount << " tasks: create " << createNs << " ns/task, yielding "
+            << yieldingNs / 1000 << " us/pass (" << yieldingNs / taskCount << " ns/task), "
+            << BUSYTASKS << " yielding, others delayed " << delayedNs / 1000 << " us/pass" << std::endl;
+
+        stop = true;
+        for (auto task : tasks) task->wakeup();
+        while (reaped < tasks.size()) runCoopTasks(reaper);
+    }
+}
+
+int main()
+{
+    for (size_t taskCount : { 1000, 10000, 100000 })
+    {
+        benchmark(taskCount);
+    }
+    return 0;
+}
@@ -0,0 +1,103 @@
+// sharedstack.cpp
+// This example runs tasks in turn on one stack with CoopTaskStackAllocatorShared.
+// Each task fills frames in a recursion, and switches away at its deepest level, either
+// by yield() or by handoff() to its partner task. The partner has a stack of its own,
+// as handoff() switches directly only to a task whose stack is in place.
+// The pair waits for each other's handoff at the top level, above the frames.
+// When a task resumes, its frames must have been restored intact.
+// Objects that tasks share must not live on a shared stack, the semaphores are therefore
+// in main(). On Linux, another task on the shared stack reads from a pipe into a buffer on
+// its stack by coopRead(), while the others run.
+
+#include <iostream>
+#include <cstring>
+#include "CoopTask.h"
+#include "CoopSemaphore.h"
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+namespace
+{
+    constexpr int ROUNDS = 1000;
+    constexpr int DEPTH = 8;
+    constexpr size_t TASKSTACKSIZE = 0x4000;
+    constexpr size_t SHAREDSTACKSIZE = 0x4000;
+
+    using SharedStack = CoopTaskStackAllocatorShared<SHAREDSTACKSIZE>;
+
+    // fills a frame per level with the task's pattern, switches away at the deepest level, and counts the damaged frames
+    template<typename Switch> int recurse(int depth, unsigned pattern, Switch& switchAway)
+    {
+        volatile unsigned frame[64];
+        for (auto& word : frame) word = pattern + depth;
+        int bad = depth ? recurse(depth - 1, pattern, switchAway) : (switchAway(), 0);
+        for (auto& word : frame) if (word != pattern + depth) { ++bad; break; }
+        return bad;
+    }
+}
+
+int main()
+{
+    int bad = 0;
+    CoopSemaphore ping(0);
+    CoopSemaphore pong(0);
+    createCoopTask<void, SharedStack>(std::string("pinger"), [&]() noexcept
+        {
+            auto switchAway = [&]() { ping.handoff(); };
+            for (int i = 0; i < ROUNDS; ++i)
+            {
+                bad += recurse(DEPTH, 0x1000, switchAway);
+                pong.wait();
+            }
+        }, SHAREDSTACKSIZE);
+    createCoopTask<void>(std::string("ponger"), [&]() noexcept
+        {
+            auto switchAway = [&]() { pong.handoff(); };
+            for (int i = 0; i < ROUNDS; ++i)
+            {
+                ping.wait();
+                bad += recurse(DEPTH + 2, 0x2000, switchAway);
+            }
+        }, TASKSTACKSIZE);
+    // scribbles on the shared stack between the handoffs
+    createCoopTask<void, SharedStack>(std::string("scribbler"), [&]() noexcept
+        {
+            auto switchAway = []() { yield(); };
+            for (int i = 0; i < ROUNDS; ++i) bad += recurse(DEPTH + 4, 0x3000, switchAway);
+        }, SHAREDSTACKSIZE);
+#if defined(__linux__)
+    int pipeFds[2];
+    if (::pipe(pipeFds)) return 1;
+    createCoopTask<void, SharedStack>(std::string("reader"), [&]() noexcept
+        {
+            for (int i = 0; i < ROUNDS; ++i)
+            {
+                char buf[256];
+                ::memset(buf, 0, sizeof(buf));
+                if (CoopTask<void>::coopRead(pipeFds[0], buf, sizeof(buf)) != sizeof(buf)) ++bad;
+                for (const auto c : buf) if (c != static_cast<char>(i)) { ++bad; break; }
+            }
+        }, SHAREDSTACKSIZE);
+    createCoopTask<void>(std::string("writer"), [&]() noexcept
+        {
+            for (int i = 0; i < ROUNDS; ++i)
+            {
+                char buf[256];
+                ::memset(buf, i, sizeof(buf));
+                yield();
+                if (::write(pipeFds[1], buf, sizeof(buf)) != sizeof(buf)) ++bad;
+            }
+        }, TASKSTACKSIZE);
+#endif
+    while (CoopScheduler::defaultScheduler().getRunnableTasksCount())
+    {
+        runCoopTasks([](const CoopTaskBase* const task) { delete task; });
+    }
+#if defined(__linux__)
+    ::close(pipeFds[0]);
+    ::close(pipeFds[1]);
+#endif
+    std::cerr << "damaged frames or data " << bad << std::endl;
+    return bad ? 1 : 0;
+}
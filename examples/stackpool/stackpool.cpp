@@ -0,0 +1,52 @@
+// stackpool.cpp
+// This is a benchmark of the stack allocators on host builds.
+// Batches of short-lived tasks are created, run to completion, and deleted by the reaper,
+// such that each batch reuses the stacks of the previous one.
+// CoopTaskStackAllocatorPool recycles the stacks instead of freeing them, and does not
+// fill their untouched bottom part with stack cookies again.
+// On Linux, CoopTaskStackAllocatorMmap maps each stack above a guard page, which costs
+// a system call per task, but commits only the touched pages of its large stack.
+
+#include <iostream>
+#include <chrono>
+#include "CoopTask.h"
+
+namespace
+{
+    constexpr int BATCHES = 200;
+    constexpr int BATCHSIZE = 100;
+    constexpr size_t TASKSTACKSIZE = 0x4000;
+
+    template<class StackAllocator> double usPerTask(size_t stackSize = TASKSTACKSIZE)
+    {
+        const Delegate<void(const CoopTaskBase* const task)> reaper = [](const CoopTaskBase* const task) { delete task; };
+        const auto start = std::chrono::steady_clock::now();
+        for (int batch = 0; batch < BATCHES; ++batch)
+        {
+            for (int i = 0; i < BATCHSIZE; ++i)
+            {
+                auto task = createCoopTask<void, StackAllocator>(std::string("short"), []() noexcept
+                    {
+                        yield();
+                    }, stackSize);
+                if (!task) std::cerr << "CoopTask not created" << std::endl;
+            }
+            while (CoopScheduler::defaultScheduler().getRunnableTasksCount())
+            {
+                runCoopTasks(reaper);
+            }
+        }
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / (BATCHES * BATCHSIZE);
+    }
+}
+
+int main()
+{
+    std::cerr << "CoopTaskStackAllocator: " << usPerTask<CoopTaskStackAllocator>() << " us per task" << std::endl;
+    std::cerr << "CoopTaskStackAllocatorPool: " << usPerTask<CoopTaskStackAllocatorPool<BATCHSIZE>>() << " us per task" << std::endl;
+#if defined(__linux__)
+    std::cerr << "CoopTaskStackAllocatorMmap: " <<
+        usPerTask<CoopTaskStackAllocatorMmap<>>(CoopTaskStackAllocatorMmap<>::DEFAULTTASKSTACKSIZE) << " us per task" << std::endl;
+#endif
+    return 0;
+}
@@ -0,0 +1,70 @@
+// workers.cpp
+// This is a benchmark of runCoopTasksOnWorkers() on Linux host builds.
+// Many independent tasks each do a slice of computation per yield. The run time
+// with a single worker thread is compared to that with one worker per core.
+// The tasks differ in their amount of work, idle workers take over ready tasks from busy ones.
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include "CoopTask.h"
+
+namespace
+{
+    using clock = std::chrono::steady_clock;
+
+    constexpr size_t TASKCOUNT = 1000;
+    constexpr size_t TASKSTACKSIZE = 0x2000;
+    constexpr int SLICES = 200;
+    constexpr int SLICEWORK = 5000;
+
+    std::atomic<uint32_t> checksum(0);
+
+    uint32_t slice(uint32_t x)
+    {
+        for (int i = 0; i < SLICEWORK; ++i)
+        {
+            x = x * 1664525U + 1013904223U;
+        }
+        return x;
+    }
+
+    double run(unsigned workers)
+    {
+        checksum.store(0);
+        for (size_t i = 0; i < TASKCOUNT; ++i)
+        {
+            const int slices = SLICES * (1 + i % 3);
+            auto task = createCoopTask<void>(std::string("task"), [i, slices]() noexcept
+                {
+                    uint32_t x = static_cast<uint32_t>(i);
+                    for (int s = 0; s < slices; ++s)
+                    {
+                        x = slice(x);
+                        yield();
+                    }
+                    checksum += x;
+                }, TASKSTACKSIZE);
+            if (!task)
+            {
+                std::cerr << "CoopTask " << i << " not created" << std::endl;
+                return 0;
+            }
+        }
+        const auto start = clock::now();
+        runCoopTasksOnWorkers([](const CoopTaskBase* const task) { delete task; }, workers);
+        return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    }
+}
+
+int main()
+{
+    const unsigned cores = std::max(1U, std::thread::hardware_concurrency());
+    const auto singleMs = run(1);
+    const auto singleChecksum = checksum.load();
+    const auto allMs = run(cores);
+    std::cerr << TASKCOUNT << " tasks: 1 worker " << singleMs << " ms, " << cores << " workers " << allMs
+        << " ms, speedup " << singleMs / allMs
+        << (singleChecksum == checksum.load() ? "" : ", checksum mismatch") << std::endl;
+    return 0;
+}
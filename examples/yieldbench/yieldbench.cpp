@@ -0,0 +1,51 @@
+// yieldbench.cpp
+// This is a microbenchmark of the context switch on host builds.
+// It reports the time of a yield() round-trip, from a task to the scheduler and back.
+// On x86_64 and aarch64 Linux, build once as is, and once with -DCOOPTASK_SETJMP,
+// to compare the assembly context switch against setjmp/longjmp.
+
+#include <iostream>
+#include <chrono>
+#include "CoopTask.h"
+
+namespace
+{
+    constexpr unsigned YIELDS = 2000000;
+
+    double nsPerYield(unsigned taskCount)
+    {
+        unsigned running = taskCount;
+        for (unsigned i = 0; i < taskCount; ++i)
+        {
+            auto task = createCoopTask<void>(std::string("yield"), [&running]() noexcept
+                {
+                    for (unsigned n = 0; n < YIELDS; ++n) yield();
+                    --running;
+                }, 0x1000);
+            if (!task) std::cerr << "CoopTask not created" << std::endl;
+        }
+        const Delegate<void(const CoopTaskBase* const task)> reaper = [](const CoopTaskBase* const task) { delete task; };
+        const auto start = std::chrono::steady_clock::now();
+        while (running)
+        {
+            runCoopTasks(reaper);
+        }
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (static_cast<double>(YIELDS) * taskCount);
+    }
+}
+
+int main()
+{
+#if defined(COOPTASK_ASMCONTEXT)
+    std::cerr << "context switch: assembly" << std::endl;
+#elif defined(_MSC_VER)
+    std::cerr << "context switch: fibers" << std::endl;
+#else
+    std::cerr << "context switch: setjmp/longjmp" << std::endl;
+#endif
+    for (unsigned taskCount : { 1, 2, 10 })
+    {
+        std::cerr << taskCount << " task(s): " << nsPerYield(taskCount) << " ns per yield round-trip" << std::endl;
+    }
+    return 0;
+}
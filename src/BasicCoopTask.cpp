@@ -22,6 +22,10 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #if defined(ARDUINO) && !defined(ESP32_FREERTOS)
 #include <alloca.h>
 #endif
+#if defined(__linux__) && !defined(ARDUINO)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #if !defined(_MSC_VER) && !defined(ESP32_FREERTOS)
 
@@ -39,6 +43,114 @@ char* CoopTaskStackAllocator::allocateStack(size_t stackSize)
     return stackTop;
 }
 
+#ifndef ARDUINO
+std::mutex CoopTaskStackAllocatorPoolBase::poolMutex;
+#endif
+
+char* CoopTaskStackAllocatorPoolBase::allocateStack(SizeClass* sizeClasses, size_t sizeClassCount, size_t minStackSize, size_t stackSize)
+{
+    constexpr size_t COOKIES = (CoopTaskBase::FULLFEATURES ? 2 : 1) * sizeof(CoopTaskBase::STACKCOOKIE);
+    if (stackSize > CoopTaskBase::MAXSTACKSPACE - COOKIES) return nullptr;
+    this->stackSize = stackSize;
+    size_t classStackSize = minStackSize;
+    sizeClass = 0;
+    while (classStackSize < stackSize)
+    {
+        classStackSize <<= 1;
+        ++sizeClass;
+    }
+    if (sizeClass >= sizeClassCount) return nullptr;
+    PooledStack* pooled;
+    {
+#ifndef ARDUINO
+        std::lock_guard<std::mutex> lock(poolMutex);
+#endif
+        pooled = sizeClasses[sizeClass].head;
+        if (pooled)
+        {
+            sizeClasses[sizeClass].head = pooled->next;
+            --sizeClasses[sizeClass].count;
+        }
+    }
+    if (pooled)
+    {
+        painted = pooled->painted;
+        return reinterpret_cast<char*>(pooled) - classStackSize - COOKIES;
+    }
+    painted = 0;
+#if defined(ESP8266)
+    return new (std::nothrow) char[classStackSize + COOKIES + sizeof(PooledStack)];
+#else
+    return new char[classStackSize + COOKIES + sizeof(PooledStack)];
+#endif
+}
+
+void CoopTaskStackAllocatorPoolBase::disposeStack(SizeClass* sizeClasses, size_t minStackSize, size_t maxRetained, char* stackTop)
+{
+    if (!stackTop) return;
+    constexpr size_t COOKIES = (CoopTaskBase::FULLFEATURES ? 2 : 1) * sizeof(CoopTaskBase::STACKCOOKIE);
+    const size_t classStackSize = minStackSize << sizeClass;
+    auto pooled = reinterpret_cast<PooledStack*>(stackTop + classStackSize + COOKIES);
+    // The stack grows downwards, below its high water mark the cookies are intact.
+    // Comparing in chunks without early exit lets the compiler vectorize the search.
+    constexpr size_t CHUNK = 16;
+    const size_t words = (stackSize + COOKIES) / sizeof(CoopTaskBase::STACKCOOKIE);
+    const auto stack = reinterpret_cast<const unsigned*>(stackTop);
+    size_t pos = 0;
+    while (pos + CHUNK <= words)
+    {
+        unsigned diff = 0;
+        for (size_t i = 0; i < CHUNK; ++i) diff |= stack[pos + i] ^ CoopTaskBase::STACKCOOKIE;
+        if (diff) break;
+        pos += CHUNK;
+    }
+    while (pos < words && CoopTaskBase::STACKCOOKIE == stack[pos]) ++pos;
+    pooled->painted = pos * sizeof(CoopTaskBase::STACKCOOKIE);
+    {
+#ifndef ARDUINO
+        std::lock_guard<std::mutex> lock(poolMutex);
+#endif
+        if (sizeClasses[sizeClass].count < maxRetained)
+        {
+            pooled->next = sizeClasses[sizeClass].head;
+            sizeClasses[sizeClass].head = pooled;
+            ++sizeClasses[sizeClass].count;
+            return;
+        }
+    }
+    delete[] stackTop;
+}
+
+#if defined(__linux__) && !defined(ARDUINO)
+char* CoopTaskStackAllocatorMmapBase::allocateStack(size_t stackSize)
+{
+    static const size_t pageSize = ::sysconf(_SC_PAGESIZE);
+    // the guard page, followed by the stack and its unused cookie space, rounded up to whole pages
+    mappedSize = ((stackSize + 2 * sizeof(CoopTaskBase::STACKCOOKIE) + pageSize - 1) / pageSize + 1) * pageSize;
+    auto mapped = ::mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (MAP_FAILED == mapped)
+    {
+        mappedSize = 0;
+        return nullptr;
+    }
+    if (::mprotect(mapped, pageSize, PROT_NONE))
+    {
+        ::munmap(mapped, mappedSize);
+        mappedSize = 0;
+        return nullptr;
+    }
+    return static_cast<char*>(mapped) + pageSize;
+}
+
+void CoopTaskStackAllocatorMmapBase::disposeStack(char* stackTop)
+{
+    if (!stackTop) return;
+    static const size_t pageSize = ::sysconf(_SC_PAGESIZE);
+    ::munmap(stackTop - pageSize, mappedSize);
+}
+#endif
+
 #endif // !defined(_MSC_VER) && !defined(ESP32_FREERTOS)
 
 #if (defined(ARDUINO) && !defined(ESP32_FREERTOS)) || defined(__GNUC__)
@@ -77,18 +77,143 @@ public:
 #endif
 };
 
+class CoopTaskStackAllocatorPoolBase
+{
+public:
+    static constexpr size_t DEFAULTTASKSTACKSIZE = CoopTaskBase::DEFAULTTASKSTACKSIZE;
+    /// @returns: the number of bytes at the bottom of the allocated stack, that still hold
+    /// the stack cookie from its previous use, and need not be filled again.
+    size_t paintedStackSize() const { return painted; }
+
+protected:
+    // The header of a pooled stack, placed after the stack cookies of its size class.
+    struct PooledStack
+    {
+        PooledStack* next;
+        size_t painted;
+    };
+    struct SizeClass
+    {
+        PooledStack* head;
+        size_t count;
+    };
+    size_t sizeClass = 0;
+    size_t stackSize = 0;
+    size_t painted = 0;
+#if !defined(_MSC_VER) && !defined(ESP32_FREERTOS)
+    char* allocateStack(SizeClass* sizeClasses, size_t sizeClassCount, size_t minStackSize, size_t stackSize);
+    void disposeStack(SizeClass* sizeClasses, size_t minStackSize, size_t maxRetained, char* stackTop);
+#ifndef ARDUINO
+    static std::mutex poolMutex;
+#endif
+#endif
+};
+
+/// A stack allocator that recycles the stacks of deleted tasks, instead of freeing them.
+/// Stacks are pooled in size classes of powers of two, starting at MinStackSize, and the
+/// bottom part of a recycled stack that is left untouched is not filled with stack cookies again.
+/// @param MaxRetained the maximum number of stacks that each size class retains for reuse.
+/// @param MinStackSize the stack size of the smallest size class.
+template<size_t MaxRetained = 8, size_t MinStackSize = (sizeof(unsigned) >= 4) ? 0x100 : 0x20>
+class CoopTaskStackAllocatorPool : public CoopTaskStackAllocatorPoolBase
+{
+protected:
+    static constexpr size_t sizeClassCount(size_t stackSize)
+    {
+        return (stackSize >= CoopTaskBase::MAXSTACKSPACE) ? 1 : 1 + sizeClassCount(stackSize << 1);
+    }
+    static constexpr size_t SIZECLASSES = sizeClassCount(MinStackSize);
+    static SizeClass sizeClasses[SIZECLASSES];
+
+public:
+#if !defined(_MSC_VER) && !defined(ESP32_FREERTOS)
+    char* allocateStack(size_t stackSize)
+    {
+        return CoopTaskStackAllocatorPoolBase::allocateStack(sizeClasses, SIZECLASSES, MinStackSize, stackSize);
+    }
+    void disposeStack(char* stackTop)
+    {
+        CoopTaskStackAllocatorPoolBase::disposeStack(sizeClasses, MinStackSize, MaxRetained, stackTop);
+    }
+#endif
+};
+
+template<size_t MaxRetained, size_t MinStackSize>
+CoopTaskStackAllocatorPoolBase::SizeClass CoopTaskStackAllocatorPool<MaxRetained, MinStackSize>::sizeClasses[CoopTaskStackAllocatorPool<MaxRetained, MinStackSize>::SIZECLASSES] {};
+
+/// A stack allocator that lets all tasks that use it run in turn on one shared stack of SharedStackSize.
+/// When another task runs on the shared stack, only the live part of a task's stack is saved into
+/// a buffer of the required size, and restored before the task resumes. Objects on the stack of such a task
+/// must not be accessed from other tasks. The task's stack size is that of the shared stack.
+template<size_t SharedStackSize = CoopTaskBase::DEFAULTTASKSTACKSIZE>
+class CoopTaskStackAllocatorShared
+{
+public:
+    static constexpr size_t DEFAULTTASKSTACKSIZE =
+        (sizeof(unsigned) >= 4) ? ((SharedStackSize + sizeof(unsigned) - 1) / sizeof(unsigned)) * sizeof(unsigned) : SharedStackSize;
+
+#if !defined(_MSC_VER) && !defined(ESP32_FREERTOS)
+    static CoopTaskBase::SharedStack* sharedStack() { return &shared; }
+    static char* allocateStack(size_t stackSize)
+    {
+        return (DEFAULTTASKSTACKSIZE >= stackSize) ? sharedStackTop : nullptr;
+    }
+    static void disposeStack(char* stackTop) { }
+
+protected:
+    alignas(16) static char sharedStackTop[DEFAULTTASKSTACKSIZE + (CoopTaskBase::FULLFEATURES ? 2 : 1) * sizeof(CoopTaskBase::STACKCOOKIE)];
+    static CoopTaskBase::SharedStack shared;
+#endif
+};
+
+#if !defined(_MSC_VER) && !defined(ESP32_FREERTOS)
+template<size_t SharedStackSize>
+alignas(16) char CoopTaskStackAllocatorShared<SharedStackSize>::sharedStackTop[CoopTaskStackAllocatorShared<SharedStackSize>::DEFAULTTASKSTACKSIZE + (CoopTaskBase::FULLFEATURES ? 2 : 1) * sizeof(CoopTaskBase::STACKCOOKIE)];
+template<size_t SharedStackSize>
+CoopTaskBase::SharedStack CoopTaskStackAllocatorShared<SharedStackSize>::shared {};
+#endif
+
+#if defined(__linux__) && !defined(ARDUINO)
+class CoopTaskStackAllocatorMmapBase
+{
+public:
+    char* allocateStack(size_t stackSize);
+    void disposeStack(char* stackTop);
+
+protected:
+    size_t mappedSize = 0;
+};
+
+/// A stack allocator that maps each stack above an inaccessible guard page. Stack pages are committed
+/// only when first touched, so large stacks cost memory only for their used part, and
+/// a stack overflow traps immediately. No stack cookies are used, getFreeStack() reports
+/// the untouched part of the stack in whole pages.
+template<size_t StackSize = 0x100000>
+class CoopTaskStackAllocatorMmap : public CoopTaskStackAllocatorMmapBase
+{
+public:
+    static constexpr size_t DEFAULTTASKSTACKSIZE = StackSize;
+};
+#endif
+
 template<class StackAllocator = CoopTaskStackAllocator> class BasicCoopTask : public CoopTaskBase
 {
 public:
 #ifdef ARDUINO
-    BasicCoopTask(const String& name, taskfunction_t _func, size_t stackSize = StackAllocator::DEFAULTTASKSTACKSIZE) :
+    BasicCoopTask(String name, taskfunction_t _func, size_t stackSize = StackAllocator::DEFAULTTASKSTACKSIZE) :
 #else
-    BasicCoopTask(const std::string& name, taskfunction_t _func, size_t stackSize = StackAllocator::DEFAULTTASKSTACKSIZE) :
+    BasicCoopTask(std::string name, taskfunction_t _func, size_t stackSize = StackAllocator::DEFAULTTASKSTACKSIZE) :
 #endif
-        CoopTaskBase(name, _func, stackSize)
+        CoopTaskBase(std::move(name), std::move(_func), stackSize)
     {
 #if !defined(_MSC_VER) && !defined(ESP32_FREERTOS)
         taskStackTop = stackAllocator.allocateStack(taskStackSize);
+        taskStackPainted = paintedStackSize(&stackAllocator);
+#if defined(__linux__) && !defined(ARDUINO)
+        taskStackGuarded = guardedStack(&stackAllocator);
+#endif
+        sharedStack = sharedStackOf(&stackAllocator);
+        if (sharedStack) taskStackSize = StackAllocator::DEFAULTTASKSTACKSIZE;
 #endif
     }
     BasicCoopTask(const BasicCoopTask&) = delete;
@@ -101,13 +226,33 @@ public:
     }
     /// Every task is entered into this list by scheduleTask(). It is removed when it exits
     /// or gets deleted.
+#ifndef ARDUINO
+    static const std::deque< std::atomic<BasicCoopTask* > >& getRunnableTasks()
+    {
+        // this is safe to do because CoopTaskBase ctor is protected.
+        return reinterpret_cast<const std::deque< std::atomic<BasicCoopTask* > >&>(CoopTaskBase::getRunnableTasks());
+    }
+#else
     static const std::array< std::atomic<BasicCoopTask* >, MAXNUMBERCOOPTASKS + 1>& getRunnableTasks()
     {
         // this is safe to do because CoopTaskBase ctor is protected.
         return reinterpret_cast<const std::array< std::atomic<BasicCoopTask* >, MAXNUMBERCOOPTASKS + 1>&>(CoopTaskBase::getRunnableTasks());
     }
+#endif
 protected:
     StackAllocator stackAllocator;
+
+    static size_t paintedStackSize(const void*) { return 0; }
+    static size_t paintedStackSize(const CoopTaskStackAllocatorPoolBase* allocator) { return allocator->paintedStackSize(); }
+#if !defined(_MSC_VER) && !defined(ESP32_FREERTOS)
+    static SharedStack* sharedStackOf(const void*) { return nullptr; }
+    template<size_t SharedStackSize>
+    static SharedStack* sharedStackOf(const CoopTaskStackAllocatorShared<SharedStackSize>*) { return CoopTaskStackAllocatorShared<SharedStackSize>::sharedStack(); }
+#endif
+#if defined(__linux__) && !defined(ARDUINO)
+    static bool guardedStack(const void*) { return false; }
+    static bool guardedStack(const CoopTaskStackAllocatorMmapBase*) { return true; }
+#endif
 };
 
 #endif // __BasicCoopTask_h
@@ -0,0 +1,124 @@
+/*
+CoopConditionVariable.cpp - Implementation of a condition variable for cooperative scheduling tasks
+Copyright (c) 2019 Dirk O. Kaar. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "CoopConditionVariable.h"
+
+#if defined(ESP8266)
+#include <interrupts.h>
+using esp8266::InterruptLock;
+#elif !defined(ESP32) && defined(ARDUINO)
+class InterruptLock {
+public:
+    InterruptLock() {
+        noInterrupts();
+    }
+    ~InterruptLock() {
+        interrupts();
+    }
+};
+#endif
+
+uint32_t CoopConditionVariable::now()
+{
+#if defined(ARDUINO)
+    return millis();
+#else
+    // timeouts are measured by the scheduler's clock, read live like by CoopSemaphore
+    return static_cast<uint32_t>(CoopTaskBase::clockNow() / 1000);
+#endif
+}
+
+void CoopConditionVariable::addWaiter()
+{
+#if !defined(ESP32) && defined(ARDUINO)
+    InterruptLock lock;
+    waiters.store(waiters.load() + 1);
+#else
+    unsigned val = 0;
+    while (!waiters.compare_exchange_weak(val, val + 1)) {}
+#endif
+}
+
+bool CoopConditionVariable::removeWaiter()
+{
+#if !defined(ESP32) && defined(ARDUINO)
+    InterruptLock lock;
+    const unsigned val = waiters.load();
+    if (!val) return false;
+    waiters.store(val - 1);
+    return true;
+#else
+    unsigned val = waiters.load();
+    while (val && !waiters.compare_exchange_weak(val, val - 1)) {}
+    return val;
+#endif
+}
+
+bool IRAM_ATTR CoopConditionVariable::notify(unsigned count)
+{
+    unsigned notified;
+#if !defined(ESP32) && defined(ARDUINO)
+    {
+        InterruptLock lock;
+        const unsigned val = waiters.load();
+        notified = val < count ? val : count;
+        waiters.store(val - notified);
+    }
+#else
+    unsigned val = waiters.load();
+    do
+    {
+        notified = val < count ? val : count;
+    } while (notified && !waiters.compare_exchange_weak(val, val - notified));
+#endif
+    // a single post wakes up all notified tasks
+    return !notified || post(notified);
+}
+
+bool IRAM_ATTR CoopConditionVariable::notify_one()
+{
+    return notify(1);
+}
+
+bool IRAM_ATTR CoopConditionVariable::notify_all()
+{
+    return notify(~0U);
+}
+
+bool CoopConditionVariable::await(const bool withDeadline, const uint32_t ms)
+{
+    if (withDeadline ? CoopSemaphore::wait(ms) : CoopSemaphore::wait()) return true;
+    if (removeWaiter()) return false;
+    // notified along with the timeout, its unit is taken, such that no other task is woken up for it
+    return CoopSemaphore::wait();
+}
+
+bool CoopConditionVariable::_wait(CoopMutex& mutex, const bool withDeadline, const uint32_t ms)
+{
+    // counted before the mutex is unlocked, such that no notification after that is lost
+    addWaiter();
+    if (!mutex.unlock())
+    {
+        if (!removeWaiter()) CoopSemaphore::wait();
+        return false;
+    }
+    const bool notified = await(withDeadline, ms);
+    mutex.lock();
+    return notified;
+}
@@ -0,0 +1,104 @@
+/*
+CoopConditionVariable.h - Implementation of a condition variable for cooperative scheduling tasks
+Copyright (c) 2019 Dirk O. Kaar. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __CoopConditionVariable_h
+#define __CoopConditionVariable_h
+
+#include "CoopMutex.h"
+
+/// A condition variable that is safe to use from CoopTasks, together with a CoopMutex.
+/// Each waiting task is counted, a notification takes that many of the counted tasks and posts
+/// as many units to the underlying semaphore at once. On Linux host builds, notify_all() thereby makes
+/// all waiting tasks ready in a single scheduler pass, elsewhere, it wakes up the first waiting task,
+/// which makes the others ready when it runs.
+/// Like CoopSemaphore::post(), notify_one() and notify_all() are safe to use from interrupt
+/// service routines, or concurrent OS threads, that don't hold the mutex.
+class CoopConditionVariable : private CoopSemaphore
+{
+protected:
+    // the number of waiting tasks that are not notified yet
+    std::atomic<unsigned> waiters;
+
+    /// Counts the running task as waiting, before it releases the mutex.
+    void addWaiter();
+    /// @returns: true if a waiting task that is not notified yet was uncounted,
+    /// false if all counted tasks are notified already.
+    bool removeWaiter();
+    /// Notifies up to count of the waiting tasks.
+    bool IRAM_ATTR notify(unsigned count);
+    /// Sleeps until the notification of a counted task.
+    /// @returns: true if it was notified, false if the deadline expired.
+    bool await(const bool withDeadline = false, const uint32_t ms = 0);
+    /// @returns: the time in milliseconds that timeouts are measured by.
+    static uint32_t now();
+
+    bool _wait(CoopMutex& mutex, const bool withDeadline = false, const uint32_t ms = 0);
+
+public:
+    CoopConditionVariable() : CoopSemaphore(0), waiters(0) {}
+    CoopConditionVariable(const CoopConditionVariable&) = delete;
+    CoopConditionVariable& operator=(const CoopConditionVariable&) = delete;
+
+    /// Wakes up one waiting task, if any.
+    bool IRAM_ATTR notify_one();
+
+    /// Wakes up all waiting tasks.
+    bool IRAM_ATTR notify_all();
+
+    /// Unlocks the mutex, that the running task has locked, and sleeps until it is notified.
+    /// The mutex is locked again before it returns.
+    /// @returns: true if it was notified, false if the running task did not own the mutex.
+    bool wait(CoopMutex& mutex)
+    {
+        return _wait(mutex);
+    }
+
+    /// Waits until pred() returns true, pred() is only called while the mutex is locked.
+    /// @returns: true when pred() returns true, false if the running task did not own the mutex.
+    template<typename Predicate> bool wait(CoopMutex& mutex, Predicate pred)
+    {
+        while (!pred())
+        {
+            if (!_wait(mutex)) return false;
+        }
+        return true;
+    }
+
+    /// @param ms the relative timeout, measured in milliseconds.
+    /// @returns: true if it was notified, false if the timeout expired, or the running task did not own the mutex.
+    bool wait_for(CoopMutex& mutex, uint32_t ms)
+    {
+        return _wait(mutex, true, ms);
+    }
+
+    /// @param ms the relative timeout, measured in milliseconds.
+    /// @returns: the result of pred(), after it returns true or the timeout expired.
+    template<typename Predicate> bool wait_for(CoopMutex& mutex, uint32_t ms, Predicate pred)
+    {
+        const uint32_t start = now();
+        while (!pred())
+        {
+            const uint32_t expired = now() - start;
+            if (expired >= ms || !_wait(mutex, true, ms - expired)) return pred();
+        }
+        return true;
+    }
+};
+
+#endif // __CoopConditionVariable_h
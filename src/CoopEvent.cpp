@@ -0,0 +1,78 @@
+/*
+CoopEvent.cpp - Implementation of manual- and auto-reset events for cooperative scheduling tasks
+Copyright (c) 2019 Dirk O. Kaar. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "CoopEvent.h"
+
+#if defined(ESP8266)
+#include <interrupts.h>
+using esp8266::InterruptLock;
+#elif !defined(ESP32) && defined(ARDUINO)
+class InterruptLock {
+public:
+    InterruptLock() {
+        noInterrupts();
+    }
+    ~InterruptLock() {
+        interrupts();
+    }
+};
+#endif
+
+bool IRAM_ATTR CoopEvent::consume()
+{
+    if (!autoReset) return signaled.load();
+#if !defined(ESP32) && defined(ARDUINO)
+    InterruptLock lock;
+    const bool val = signaled.load();
+    signaled.store(false);
+    return val;
+#else
+    return signaled.exchange(false);
+#endif
+}
+
+bool IRAM_ATTR CoopEvent::set()
+{
+    // set before the waiting tasks are notified, such that a task that starts waiting meanwhile finds it set
+    signaled.store(true);
+    if (!autoReset) return notify(~0U);
+    if (!waiters.load()) return true;
+    // the tasks that wait now reset it, the notified ones are taken off the waiters
+    consume();
+    return notify(~0U);
+}
+
+void IRAM_ATTR CoopEvent::reset()
+{
+    signaled.store(false);
+}
+
+bool CoopEvent::_wait(const bool withDeadline, const uint32_t ms)
+{
+    if (consume()) return true;
+    addWaiter();
+    // a set that came before it was counted did not notify it
+    if (consume())
+    {
+        // if a set has notified it in the meantime, it takes that notification too
+        if (!removeWaiter()) await();
+        return true;
+    }
+    return await(withDeadline, ms);
+}
@@ -0,0 +1,79 @@
+/*
+CoopEvent.h - Implementation of manual- and auto-reset events for cooperative scheduling tasks
+Copyright (c) 2019 Dirk O. Kaar. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __CoopEvent_h
+#define __CoopEvent_h
+
+#include "CoopConditionVariable.h"
+
+/// An event that CoopTasks wait for, until it is set.
+/// On Linux host builds, set() makes all waiting tasks ready in a single scheduler pass,
+/// elsewhere, it wakes up the first waiting task, which makes the others ready when it runs.
+/// A manual-reset event stays set until reset(), tasks that wait in the meantime don't sleep.
+/// An auto-reset event is reset by the tasks it wakes up. If no task waits when it is set,
+/// it stays set until the next task waits for it, such that a set() is never lost.
+/// set() and reset() are safe to use from interrupt service routines, or concurrent OS threads.
+class CoopEvent : private CoopConditionVariable
+{
+protected:
+    std::atomic<bool> signaled;
+    const bool autoReset;
+
+    /// @returns: true if the event is set, an auto-reset event is reset at the same time.
+    bool IRAM_ATTR consume();
+
+    bool _wait(const bool withDeadline = false, const uint32_t ms = 0);
+
+public:
+    /// @param _autoReset true: the event is reset by the tasks that it wakes up.
+    /// false: the event stays set until reset().
+    /// @param initialState true: the event is initially set.
+    explicit CoopEvent(bool _autoReset = false, bool initialState = false) :
+        signaled(initialState), autoReset(_autoReset) {}
+    CoopEvent(const CoopEvent&) = delete;
+    CoopEvent& operator=(const CoopEvent&) = delete;
+
+    /// Sets the event, and wakes up all waiting tasks.
+    bool IRAM_ATTR set();
+
+    /// Resets the event, tasks that wait afterwards sleep until the next set().
+    void IRAM_ATTR reset();
+
+    /// @returns: true if the event is set.
+    bool is_set() const
+    {
+        return signaled.load();
+    }
+
+    /// @returns: true when the event is set, either immediately or after sleeping.
+    bool wait()
+    {
+        return _wait();
+    }
+
+    /// @param ms the relative timeout, measured in milliseconds, for the event to be set.
+    /// @returns: true when the event is set, either immediately or after sleeping.
+    /// false if the timeout expired.
+    bool wait(uint32_t ms)
+    {
+        return _wait(true, ms);
+    }
+};
+
+#endif // __CoopEvent_h
@@ -29,6 +29,7 @@ protected:
     std::atomic<CoopTaskBase*> owner;
 
 public:
+    /// @param maxPending deprecated, the number of concurrently waiting tasks is unlimited. Accepted and ignored.
     CoopMutex(size_t maxPending = 10) : CoopSemaphore(1, maxPending), owner(nullptr) {}
     CoopMutex(const CoopMutex&) = delete;
     CoopMutex& operator=(const CoopMutex&) = delete;
@@ -36,15 +37,16 @@ public:
     /// @returns: true, or false, if the current task does not own the mutex.
     bool unlock()
     {
-        if (CoopTaskBase::running() && CoopTaskBase::self() == owner.load() && post())
+        if (CoopTaskBase::running() && CoopTaskBase::self() == owner.load())
         {
+            // released before the post, a waiter on another worker thread may lock it immediately
             owner.store(nullptr);
-            return true;
+            return post();
         }
         return false;
     }
 
-    /// @returns: true if the mutex becomes locked. false if it is already locked by the same task, or the maximum number of pending tasks is exceeded.
+    /// @returns: true if the mutex becomes locked. false if it is already locked by the same task.
     bool lock()
     {
         if (CoopTaskBase::running() && CoopTaskBase::self() != owner.load() && wait())
@@ -55,6 +57,19 @@ public:
         return false;
     }
 
+    /// @param ms the relative timeout, measured in milliseconds, for locking the mutex.
+    /// @returns: true if the mutex becomes locked, either immediately or after sleeping.
+    /// false if the timeout expired, or it is already locked by the same task.
+    bool try_lock_for(uint32_t ms)
+    {
+        if (CoopTaskBase::running() && CoopTaskBase::self() != owner.load() && wait(ms))
+        {
+            owner.store(CoopTaskBase::self());
+            return true;
+        }
+        return false;
+    }
+
     /// @returns: true if the mutex becomes freshly locked without waiting, otherwise false.
     bool try_lock()
     {
@@ -0,0 +1,174 @@
+/*
+CoopRWMutex.h - Implementation of a reader-writer mutex and RAII locks for cooperative scheduling tasks
+Copyright (c) 2019 Dirk O. Kaar. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __CoopRWMutex_h
+#define __CoopRWMutex_h
+
+#include "CoopSemaphore.h"
+
+/// A reader-writer mutex that is safe to use from CoopTasks.
+/// Any number of tasks may hold it shared, or a single task exclusively.
+/// Each reader takes one unit of the semaphore, a writer takes all of them at once,
+/// so that unlocking by a writer wakes up all waiting readers in the same scheduler pass.
+/// With writer preference, readers that start waiting while a writer waits queue behind it,
+/// otherwise they share the mutex with the current readers, and the writer waits for all of them.
+/// The shared lock is not recursive, a task that holds it must not lock it again.
+class CoopRWMutex : private CoopSemaphore
+{
+protected:
+    static constexpr unsigned MAXREADERS = ~0U >> 1;
+    std::atomic<CoopTaskBase*> owner;
+    const bool writerPreference;
+
+public:
+    /// @param _writerPreference true: waiting writers go ahead of readers that arrive later.
+    /// false: readers go ahead while the mutex is locked shared, writers may starve.
+    explicit CoopRWMutex(bool _writerPreference = true) :
+        CoopSemaphore(MAXREADERS), owner(nullptr), writerPreference(_writerPreference) {}
+    CoopRWMutex(const CoopRWMutex&) = delete;
+    CoopRWMutex& operator=(const CoopRWMutex&) = delete;
+
+    /// @returns: true, or false, if the current task does not own the mutex exclusively.
+    bool unlock()
+    {
+        if (CoopTaskBase::running() && CoopTaskBase::self() == owner.load())
+        {
+            owner.store(nullptr);
+            return post(MAXREADERS);
+        }
+        return false;
+    }
+
+    /// @returns: true if the mutex becomes locked exclusively. false if it is already locked by the same task.
+    bool lock()
+    {
+        if (CoopTaskBase::running() && CoopTaskBase::self() != owner.load() && acquire(MAXREADERS))
+        {
+            owner.store(CoopTaskBase::self());
+            return true;
+        }
+        return false;
+    }
+
+    /// @param ms the relative timeout, measured in milliseconds, for locking the mutex exclusively.
+    /// @returns: true if the mutex becomes locked, either immediately or after sleeping.
+    /// false if the timeout expired, or it is already locked by the same task.
+    bool try_lock_for(uint32_t ms)
+    {
+        if (CoopTaskBase::running() && CoopTaskBase::self() != owner.load() && acquire(MAXREADERS, ms))
+        {
+            owner.store(CoopTaskBase::self());
+            return true;
+        }
+        return false;
+    }
+
+    /// @returns: true if the mutex becomes freshly locked exclusively without waiting, otherwise false.
+    bool try_lock()
+    {
+        if (CoopTaskBase::running() && CoopTaskBase::self() != owner.load() && try_wait(MAXREADERS))
+        {
+            owner.store(CoopTaskBase::self());
+            return true;
+        }
+        return false;
+    }
+
+    /// @returns: true, or false, if the mutex is locked exclusively, or not locked shared.
+    bool unlock_shared()
+    {
+        // an unbalanced unlock_shared() would let in a reader that must wait: while a writer holds the mutex,
+        // the owner is set and the value is 0, while the mutex is unlocked, the value is MAXREADERS
+        if (CoopTaskBase::running() && !owner.load() && value.load() < MAXREADERS)
+        {
+            return post();
+        }
+        return false;
+    }
+
+    /// @returns: true if the mutex becomes locked shared. false if it is locked exclusively by the same task.
+    bool lock_shared()
+    {
+        return CoopTaskBase::running() && CoopTaskBase::self() != owner.load() &&
+            ((!writerPreference && try_wait()) || wait());
+    }
+
+    /// @param ms the relative timeout, measured in milliseconds, for locking the mutex shared.
+    /// @returns: true if the mutex becomes locked shared, either immediately or after sleeping.
+    /// false if the timeout expired, or it is locked exclusively by the same task.
+    bool try_lock_shared_for(uint32_t ms)
+    {
+        return CoopTaskBase::running() && CoopTaskBase::self() != owner.load() &&
+            ((!writerPreference && try_wait()) || wait(ms));
+    }
+
+    /// @returns: true if the mutex becomes locked shared without waiting, otherwise false.
+    bool try_lock_shared()
+    {
+        return CoopTaskBase::running() && CoopTaskBase::self() != owner.load() && try_wait();
+    }
+};
+
+/// A RAII CoopRWMutex lock class, that locks the mutex exclusively.
+class CoopExclusiveLock {
+protected:
+    CoopRWMutex& mutex;
+    bool locked;
+public:
+    /// The constructor returns if the mutex was locked, or locking failed.
+    explicit CoopExclusiveLock(CoopRWMutex& _mutex) : mutex(_mutex) {
+        locked = mutex.lock();
+    }
+    CoopExclusiveLock() = delete;
+    CoopExclusiveLock(const CoopExclusiveLock&) = delete;
+    CoopExclusiveLock& operator=(const CoopExclusiveLock&) = delete;
+    /// @returns: true if the mutex became locked, potentially after blocking, otherwise false.
+    operator bool() const {
+        return locked;
+    }
+    /// The destructor unlocks the mutex.
+    ~CoopExclusiveLock() {
+        if (locked) mutex.unlock();
+    }
+};
+
+/// A RAII CoopRWMutex lock class, that locks the mutex shared.
+class CoopSharedLock {
+protected:
+    CoopRWMutex& mutex;
+    bool locked;
+public:
+    /// The constructor returns if the mutex was locked, or locking failed.
+    explicit CoopSharedLock(CoopRWMutex& _mutex) : mutex(_mutex) {
+        locked = mutex.lock_shared();
+    }
+    CoopSharedLock() = delete;
+    CoopSharedLock(const CoopSharedLock&) = delete;
+    CoopSharedLock& operator=(const CoopSharedLock&) = delete;
+    /// @returns: true if the mutex became locked, potentially after blocking, otherwise false.
+    operator bool() const {
+        return locked;
+    }
+    /// The destructor unlocks the mutex.
+    ~CoopSharedLock() {
+        if (locked) mutex.unlock_shared();
+    }
+};
+
+#endif // __CoopRWMutex_h
@@ -0,0 +1,275 @@
+/*
+CoopScheduler.cpp - Implementation of a scheduler for cooperative scheduling tasks
+Copyright (c) 2019 Dirk O. Kaar. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "CoopScheduler.h"
+#if defined(COOPTASK_MULTITHREAD)
+#include <algorithm>
+#include <memory>
+#include <thread>
+#endif
+
+COOPTASK_THREADLOCAL CoopScheduler* CoopScheduler::currentScheduler = nullptr;
+
+CoopScheduler& CoopScheduler::defaultScheduler()
+{
+    // constructed on first use, tasks may be created by constructors of global objects
+    static CoopScheduler scheduler;
+    return scheduler;
+}
+
+void CoopScheduler::run(const Delegate<void(const CoopTaskBase* const task)>& reaper,
+    const Delegate<bool(uint32_t ms)>& onDelay, const Delegate<bool()>& onSleep)
+{
+    runPass(runQueue, reaper, onDelay, onSleep);
+}
+
+void CoopScheduler::runPass(CoopTaskBase::RunQueue& rq, const Delegate<void(const CoopTaskBase* const task)>& reaper,
+    const Delegate<bool(uint32_t ms)>& onDelay, const Delegate<bool()>& onSleep)
+{
+#ifdef ESP32_FREERTOS
+    static TaskHandle_t yieldGuardHandle = nullptr;
+    if (!yieldGuardHandle)
+    {
+        xTaskCreateUniversal([](void*)
+            {
+                for (;;)
+                {
+                    vPortYield();
+                }
+            }, "YieldGuard", 0x200, nullptr, 1, &yieldGuardHandle, CONFIG_ARDUINO_RUNNING_CORE);
+    }
+#endif
+
+    // tasks that are created by the running tasks are bound to this scheduler
+    currentScheduler = this;
+#ifndef ARDUINO
+    // delays and timers are checked against the time at the beginning of the pass
+    CoopTaskBase::passClock = CoopTaskBase::clockSource();
+    CoopTaskBase::passClockValid = true;
+#if defined(COOPTASK_REACTOR)
+    if (rq.ioWaits) rq.pollIo(0);
+#endif
+    CoopTaskBase::expireTimers(rq);
+#endif
+    // each pass runs the tasks that are ready at its beginning, others are not visited
+    CoopTaskBase::beginPass(rq);
+    bool allSleeping = true;
+    uint32_t minDelay_ms = ~(decltype(minDelay_ms))0U;
+#ifndef ARDUINO
+    // the earliest of the delays below DELAYMICROS_THRESHOLD, whose tasks stay in the ready queue
+    uint32_t nearDelay_us = ~0U;
+#endif
+#if defined(COOPTASK_MULTITHREAD)
+    bool exited = false;
+#endif
+    while (auto task = CoopTaskBase::nextPassTask(rq))
+    {
+#if defined(ESP8266) || defined(ESP32)
+        optimistic_yield(10000);
+#endif
+        auto runResult = task->run();
+        if (CoopTaskBase::handoffTask)
+        {
+            // the task has handed off the CPU, the result is that of the last task in the chain
+            task = CoopTaskBase::handoffTask;
+            CoopTaskBase::handoffTask = nullptr;
+        }
+        task->requeue(runResult);
+#if defined(COOPTASK_MULTITHREAD)
+        if (rq.stealRequest.load(std::memory_order_relaxed))
+            CoopTaskBase::shareReadyTasks(rq);
+        if (runResult < 0) exited = true;
+#endif
+        if (runResult < 0 && reaper)
+            reaper(task);
+#ifndef ARDUINO
+        else if (runResult > 0 && runResult < CoopTaskBase::DELAYMICROS_THRESHOLD && task->delayed() && !task->delayIsMs())
+        {
+            allSleeping = false;
+            if (static_cast<uint32_t>(runResult) < nearDelay_us) nearDelay_us = runResult;
+        }
+#endif
+        else if (minDelay_ms)
+        {
+            if (task->delayed())
+            {
+                allSleeping = false;
+                uint32_t delay_ms = task->delayIsMs() ? static_cast<uint32_t>(runResult) : static_cast<uint32_t>(runResult) / 1000UL;
+                if (delay_ms < minDelay_ms)
+                    minDelay_ms = delay_ms;
+            }
+            else if (!task->sleeping())
+            {
+                allSleeping = false;
+                minDelay_ms = 0;
+            }
+        }
+    }
+#ifndef ARDUINO
+    const bool ready = ~0U == nearDelay_us ? rq.hasReady() : CoopTaskBase::hasRunnableReady(rq);
+#else
+    const bool ready = rq.hasReady();
+#endif
+    if (ready || !rq.inboxEmpty())
+    {
+        // handed off, or woken up during this pass
+        allSleeping = false;
+        minDelay_ms = 0;
+    }
+
+#ifndef ARDUINO
+    CoopTaskBase::passClockValid = false;
+    if (minDelay_ms)
+    {
+        // tasks waiting in the timer queues were not visited, the earliest deadline is at the top
+        const auto timerDelay_ms = CoopTaskBase::nextTimerDelay(rq);
+        if (~0U != timerDelay_ms)
+        {
+            allSleeping = false;
+            if (timerDelay_ms < minDelay_ms) minDelay_ms = timerDelay_ms;
+        }
+    }
+    if (~0U != nearDelay_us)
+    {
+        // no other task is ready, spin until the earliest short delay expires, the next pass runs its task
+        if (minDelay_ms) CoopTaskBase::spinUntil(rq, CoopTaskBase::passClock + nearDelay_us);
+        minDelay_ms = 0;
+    }
+#endif
+
+    bool cleanup = true;
+    if (allSleeping && onSleep)
+    {
+        cleanup = onSleep();
+    }
+    else if (minDelay_ms && onDelay)
+    {
+        cleanup = onDelay(minDelay_ms);
+    }
+    if (cleanup)
+    {
+#ifdef ESP32_FREERTOS
+        vTaskSuspend(yieldGuardHandle);
+        vTaskDelay(1);
+        vTaskResume(yieldGuardHandle);
+#elif defined(COOPTASK_MULTITHREAD)
+        // if enabled, instead of returning to a busy loop, block until the earliest deadline, or until a task
+        // is scheduled from another thread. The caller may be waiting for tasks to exit, that is
+        // not blocked after a task has exited, or if no task is left.
+        if (idleBlocking() && !exited && runnableTasksCount.load())
+        {
+            if (allSleeping) rq.park(~0U);
+            else if (minDelay_ms) rq.park(minDelay_ms);
+        }
+#endif
+    }
+}
+
+
+#if defined(COOPTASK_MULTITHREAD)
+void CoopScheduler::distributeRunQueue()
+{
+    CoopTaskBase::takeReadyInbox(runQueue);
+    for (uint8_t level = 0; level < CoopTaskBase::PRIORITYLEVELS; ++level)
+    {
+        for (auto list : { &runQueue.passHead[level], &runQueue.readyHead[level] })
+        {
+            for (auto task = *list; task;)
+            {
+                auto next = task->readyNext;
+                task->removeTimer();
+                task->pushReady(*task->assignQueue());
+                task = next;
+            }
+            *list = nullptr;
+        }
+        runQueue.readyTail[level] = nullptr;
+    }
+    runQueue.readyLength = 0;
+    runQueue.passLength.store(0);
+    for (auto timers : { &runQueue.delayedTasksMs, &runQueue.delayedTasksUs })
+    {
+        while (!timers->empty())
+        {
+            auto task = timers->back();
+            task->removeTimer();
+            task->assignQueue();
+            task->insertTimer();
+        }
+    }
+}
+
+void CoopScheduler::runWorker(size_t worker, const Delegate<void(const CoopTaskBase* const task)>& reaper)
+{
+    auto& rq = *workerQueues[worker];
+    while (runnableTasksCount.load())
+    {
+        uint32_t idle_ms = 0;
+        runPass(rq, reaper,
+            [&idle_ms](uint32_t ms) { idle_ms = ms; return false; },
+            [&idle_ms]() { idle_ms = ~0U; return false; });
+        if (!idle_ms) continue;
+        // ask a busy worker to share its ready tasks
+        for (size_t i = 1; i < workerQueues.size(); ++i)
+        {
+            auto& busy = *workerQueues[(worker + i) % workerQueues.size()];
+            CoopTaskBase::RunQueue* none = nullptr;
+            if (busy.passLength.load(std::memory_order_relaxed) >= 2 &&
+                busy.stealRequest.compare_exchange_strong(none, &rq)) break;
+        }
+        // woken up by pushReady(), and at least every millisecond to look for busy workers again
+        rq.park(1);
+    }
+}
+
+void CoopScheduler::runOnWorkers(const Delegate<void(const CoopTaskBase* const task)>& reaper, unsigned workers)
+{
+    if (!workers) workers = std::max(1U, std::thread::hardware_concurrency());
+    std::vector<std::unique_ptr<CoopTaskBase::RunQueue>> queues;
+    for (unsigned i = 0; i < workers; ++i)
+    {
+        queues.emplace_back(new CoopTaskBase::RunQueue());
+        workerQueues.push_back(queues.back().get());
+    }
+    distributeRunQueue();
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < workers; ++i)
+    {
+        threads.emplace_back(&CoopScheduler::runWorker, this, i, std::cref(reaper));
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    workerQueues.clear();
+}
+#endif
+
+void runCoopTasks(const Delegate<void(const CoopTaskBase* const task)>& reaper,
+    const Delegate<bool(uint32_t ms)>& onDelay, const Delegate<bool()>& onSleep)
+{
+    CoopScheduler::defaultScheduler().run(reaper, onDelay, onSleep);
+}
+
+#if defined(COOPTASK_MULTITHREAD)
+void runCoopTasksOnWorkers(const Delegate<void(const CoopTaskBase* const task)>& reaper, unsigned workers)
+{
+    CoopScheduler::defaultScheduler().runOnWorkers(reaper, workers);
+}
+#endif
@@ -0,0 +1,115 @@
+/*
+CoopScheduler.h - Implementation of a scheduler for cooperative scheduling tasks
+Copyright (c) 2019 Dirk O. Kaar. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __CoopScheduler_h
+#define __CoopScheduler_h
+
+#include "CoopTaskBase.h"
+
+/// A scheduler owns the set of CoopTasks that are bound to it, and runs them.
+/// A CoopTask is bound at creation to CoopScheduler::current(). Independent schedulers
+/// can run on separate OS threads, they share no state other than through their tasks.
+/// runCoopTasks() runs the default scheduler.
+class CoopScheduler
+{
+public:
+    CoopScheduler() : runnableTasksCount(0), edfPolicy(false), parkWhenIdle(false)
+#if defined(COOPTASK_MULTITHREAD)
+        , nextWorker(0)
+#endif
+    {}
+    CoopScheduler(const CoopScheduler&) = delete;
+    CoopScheduler& operator=(const CoopScheduler&) = delete;
+
+    /// @returns: the scheduler that runCoopTasks() runs. It is created on first use.
+    static CoopScheduler& defaultScheduler();
+    /// @returns: the scheduler that tasks created on the calling thread are bound to, which is the
+    /// one that last ran or was made current on this thread, otherwise the default scheduler.
+    static CoopScheduler& current() { return currentScheduler ? *currentScheduler : defaultScheduler(); }
+    /// Binds the tasks that are subsequently created on the calling thread to this scheduler.
+    void makeCurrent() { currentScheduler = this; }
+
+    /// Enables or disables earliest-deadline-first ordering of the ready tasks of each priority
+    /// that have declared a deadline by CoopTaskBase::setDeadline().
+    void setEarliestDeadlineFirst(bool enable) { edfPolicy.store(enable); }
+    bool earliestDeadlineFirst() const { return edfPolicy.load(std::memory_order_relaxed); }
+
+    /// Enables or disables blocking in run() while all tasks are delayed or sleeping, on Linux.
+    /// If enabled, and the default housekeeping is performed, a pass that leaves no task ready blocks
+    /// the calling thread until the earliest deadline, or until a task is scheduled from another thread.
+    /// Disabled by default, such that run() always returns after a single pass.
+    void setIdleBlocking(bool enable) { parkWhenIdle.store(enable); }
+    bool idleBlocking() const { return parkWhenIdle.load(std::memory_order_relaxed); }
+
+    /// Performs one pass over the tasks of this scheduler that are ready to run,
+    /// see runCoopTasks() for the parameters.
+    void run(const Delegate<void(const CoopTaskBase* const task)>& reaper = nullptr,
+        const Delegate<bool(uint32_t ms)>& onDelay = nullptr, const Delegate<bool()>& onSleep = nullptr);
+
+#if defined(COOPTASK_MULTITHREAD)
+    /// Runs the tasks of this scheduler on a pool of worker threads, each with its own ready queue, until
+    /// all tasks have exited. Tasks that are ready when it starts are distributed evenly, tasks created
+    /// by a task start on its worker. Idle workers take over a share of the ready tasks of busy ones.
+    /// While the workers run, a task may only be deleted after it has exited, and tasks must not share data
+    /// other than through atomics, CoopSemaphore, CoopMutex, or other thread-safe means.
+    /// @param reaper An optional function that is called once when a task exits, on the worker thread that ran it.
+    /// @param workers The number of worker threads, by default one per core.
+    void runOnWorkers(const Delegate<void(const CoopTaskBase* const task)>& reaper = nullptr, unsigned workers = 0);
+#endif
+
+    /// Every task is entered into this list by scheduleTask(). It is removed when it exits
+    /// or gets deleted. The scheduler itself only visits the tasks in the ready queue.
+    const CoopTaskBase::runnabletasks_t& getRunnableTasks() const { return runnableTasks; }
+    /// @returns: the count of runnable, non-nullptr, tasks in the return of getRunnableTasks().
+    size_t getRunnableTasksCount() const { return runnableTasksCount.load(); }
+
+protected:
+    friend class CoopTaskBase;
+
+    CoopTaskBase::runnabletasks_t runnableTasks {};
+#ifndef ARDUINO
+    std::vector<size_t> freeRunnableSlots;
+    std::mutex runnableTasksMutex;
+#endif
+    std::atomic<size_t> runnableTasksCount;
+    CoopTaskBase::RunQueue runQueue;
+    std::atomic<bool> edfPolicy;
+    std::atomic<bool> parkWhenIdle;
+#if defined(COOPTASK_MULTITHREAD)
+    std::vector<CoopTaskBase::RunQueue*> workerQueues;
+    std::atomic<size_t> nextWorker;
+    /// Moves the tasks of the scheduler's own run queue to the workers.
+    void distributeRunQueue();
+    void runWorker(size_t worker, const Delegate<void(const CoopTaskBase* const task)>& reaper);
+#endif
+    void runPass(CoopTaskBase::RunQueue& rq, const Delegate<void(const CoopTaskBase* const task)>& reaper,
+        const Delegate<bool(uint32_t ms)>& onDelay, const Delegate<bool()>& onSleep);
+
+    static COOPTASK_THREADLOCAL CoopScheduler* currentScheduler;
+};
+
+inline CoopTaskBase::RunQueue& CoopTaskBase::home()
+{
+#if defined(COOPTASK_MULTITHREAD)
+    if (homeQueue) return *homeQueue;
+#endif
+    return scheduler->runQueue;
+}
+
+#endif // __CoopScheduler_h
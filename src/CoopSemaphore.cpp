@@ -18,6 +18,9 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
 #include "CoopSemaphore.h"
+#if defined(COOPTASK_MULTITHREAD)
+#include <sched.h>
+#endif
 
 #if defined(ESP8266)
 #include <interrupts.h>
@@ -37,221 +40,363 @@ public:
 #endif
 
 #ifndef ARDUINO
-#include <chrono>
 namespace
 {
+    // timeouts are measured by the scheduler's clock, read live like for delays, such that
+    // a wait late in a long pass does not start its deadline at the beginning of the pass
     uint32_t millis()
     {
-        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        return static_cast<uint32_t>(CoopTaskBase::clockNow() / 1000);
     }
 }
 #endif
 
-bool CoopSemaphore::_wait(const bool withDeadline, const uint32_t ms)
+#if defined(COOPTASK_MULTITHREAD)
+void CoopSemaphore::WaitLock::backoff(const std::atomic<bool>& flag)
 {
-    const uint32_t start = withDeadline ? millis() : 0;
-    uint32_t expired = 0;
-    bool selfFirst = false;
-    for (;;)
+    for (unsigned spins = 0; flag.load(std::memory_order_relaxed); ++spins)
     {
-        auto self = CoopTaskBase::self();
-        unsigned val;
-#if !defined(ESP32) && defined(ARDUINO)
+        if (spins < 64)
         {
-            InterruptLock lock;
-            val = value.load();
-            if (val)
-            {
-                value.store(val - 1);
-            }
-        }
-#else
-        val = 1;
-        while (val && !value.compare_exchange_weak(val, val - 1)) {}
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#elif defined(__aarch64__)
+            asm volatile("yield");
 #endif
-        const unsigned valOnEntry = val;
-        if (withDeadline) expired = millis() - start;
-        if (!(selfFirst && valOnEntry))
-        {
-            if (pendingTasks.push(self))
-            {
-                if (!withDeadline) self->sleep(true);
-            }
-            else
-            {
-                selfFirst = true;
-            }
         }
-        bool fwd = !selfFirst && val;
-        bool stop = false;
-        CoopTaskBase* pendingTask = nullptr;
-        bool selfSuccess = false;
-        for (;;)
+        else
         {
-            if (pendingTasks.available())
-            {
+            sched_yield();
+        }
+    }
+}
+#endif
+
+CoopTaskBase* IRAM_ATTR CoopSemaphore::loadPending()
+{
+#if !defined(ESP32) && defined(ARDUINO)
+    InterruptLock lock;
+#endif
+    return pendingTask0.load();
+}
+
+CoopTaskBase* IRAM_ATTR CoopSemaphore::takePending()
+{
+#if !defined(ESP32) && defined(ARDUINO)
+    InterruptLock lock;
+    auto pendingTask = pendingTask0.load();
+    pendingTask0.store(nullptr);
+    return pendingTask;
+#else
+    return pendingTask0.exchange(nullptr);
+#endif
+}
+
+bool IRAM_ATTR CoopSemaphore::exchangePending(CoopTaskBase*& expected, CoopTaskBase* task)
+{
+#if !defined(ESP32) && defined(ARDUINO)
+    InterruptLock lock;
+    auto pendingTask = pendingTask0.load();
+    if (pendingTask == expected)
+    {
+        pendingTask0.store(task);
+        return true;
+    }
+    expected = pendingTask;
+    return false;
+#else
+    return pendingTask0.compare_exchange_strong(expected, task);
+#endif
+}
+
+void IRAM_ATTR CoopSemaphore::addValue(unsigned count)
+{
 #if !defined(ESP32) && defined(ARDUINO)
-                {
-                    InterruptLock lock;
-                    pendingTask = pendingTask0.load();
-                    if (fwd || !pendingTask) pendingTask0.store(pendingTasks.pop());
-                }
+    InterruptLock lock;
+    value.store(value.load() + count);
 #else
-                pendingTask = nullptr;
-                bool exchd = false;
-                while ((fwd || !pendingTask) && !(exchd = pendingTask0.compare_exchange_weak(pendingTask, pendingTasks.peek()))) {}
-                if (exchd) pendingTasks.pop();
+    unsigned val = 0;
+    while (!value.compare_exchange_weak(val, val + count)) {}
 #endif
-            }
-            else
-            {
+}
+
+bool IRAM_ATTR CoopSemaphore::takeValue(unsigned count, unsigned reserve)
+{
 #if !defined(ESP32) && defined(ARDUINO)
-                {
-                    InterruptLock lock;
-                    pendingTask = pendingTask0.load();
-                    if (fwd && pendingTask) pendingTask0.store(nullptr);
-                }
+    InterruptLock lock;
+    const unsigned val = value.load();
+    if (val < count || val - count < reserve) return false;
+    value.store(val - count);
+    return true;
 #else
-                pendingTask = nullptr;
-                if (fwd) pendingTask = pendingTask0.exchange(nullptr);
+    unsigned val = value.load();
+    while (val >= count && val - count >= reserve)
+    {
+        if (value.compare_exchange_weak(val, val - count)) return true;
+    }
+    return false;
 #endif
-                stop = true;
-            }
-            if (!val)
-            {
-                break;
-            }
-            if (!(pendingTask || stop))
-            {
-                continue;
-            }
-            if (selfFirst)
-            {
-                selfFirst = false;
-                if (!withDeadline) self->sleep(false);
-                selfSuccess = true;
-            }
-            else if (pendingTask == self)
-            {
-                if (!selfSuccess)
-                {
-                    if (!withDeadline) self->sleep(false);
-                    return true;
-                }
-                if (!stop) continue;
-            }
-            else if (pendingTask)
-            {
-                pendingTask->scheduleTask(true);
-            }
-            if (stop)
-            {
-                break;
-            }
-            val -= 1;
-            fwd = val;
+}
+
+void CoopSemaphore::wakePending()
+{
+    const unsigned val = value.load();
+    unsigned available = val > pendingTasks.claimed() ? val - pendingTasks.claimed() : 0;
+    for (;;)
+    {
+        auto pendingTask = takePending();
+        auto first = pendingTasks.peek();
+        if (!pendingTask || (first && first->getPriority() > pendingTask->getPriority()))
+        {
+            // a queued task of a higher priority goes ahead of pendingTask0
+            if (pendingTask) pendingTasks.push(pendingTask, CoopWaitList::waitCount(pendingTask), true);
+            pendingTask = pendingTasks.pop();
         }
-        if (selfSuccess)
+        if (!pendingTask) return;
+        const unsigned count = CoopWaitList::waitCount(pendingTask);
+        if (count > available)
         {
-            return true;
+            CoopTaskBase* expected = nullptr;
+            exchangePending(expected, pendingTask);
+            // a post that came before it was published as pendingTask0 did not wake it up
+            expected = pendingTask;
+            if (value.load() < pendingTasks.claimed() + count || !exchangePending(expected, nullptr)) return;
         }
-        if (valOnEntry)
+        else
         {
-#if !defined(ESP32) && defined(ARDUINO)
-            InterruptLock lock;
-            val = value.load();
-            value.store(val + 1);
+            available -= count;
+        }
+        pendingTasks.claim(pendingTask);
+#if defined(COOPTASK_MULTITHREAD)
+        CoopWaitList::chain(wokenFirst, wokenLast, pendingTask);
 #else
-            while (!value.compare_exchange_weak(val, val + 1)) {}
+        pendingTask->scheduleTask(true);
 #endif
-        }
-        if (withDeadline)
+    }
+}
+
+void CoopSemaphore::leave(CoopTaskBase* self)
+{
+    self->sleep(false);
+    CoopTaskBase* expected = self;
+    exchangePending(expected, nullptr);
+    pendingTasks.remove(self);
+    wakePending();
+}
+
+bool CoopSemaphore::_wait(const unsigned count, const bool withDeadline, const uint32_t ms)
+{
+    auto self = CoopTaskBase::self();
+    const uint32_t start = withDeadline ? millis() : 0;
+    bool woken = false;
+    for (;;)
+    {
+#if defined(COOPTASK_MULTITHREAD)
+        WaitLock lock(*this);
+        if (CoopWaitList::waking(self).load(std::memory_order_acquire))
         {
-            if (expired >= ms)
-            {
-                pendingTasks.for_each_rev_requeue(notIsSelfTask);
-#if !defined(ESP32) && defined(ARDUINO)
-                {
-                    InterruptLock lock;
-                    pendingTask = pendingTask0.load();
-                    if (pendingTask == self) pendingTask0.store(pendingTasks.available() ? pendingTasks.pop() : nullptr);
-                }
-#else
-                bool exchd = false;
-                pendingTask = self;
-                while ((pendingTask == self) && !(exchd = pendingTask0.compare_exchange_weak(pendingTask, pendingTasks.available() ? pendingTasks.peek() : nullptr))) {}
-                if (exchd && pendingTasks.available()) pendingTasks.pop();
+            // woken up by its timeout while a post that claimed it has yet to schedule it
+            lock.unlock();
+            WaitLock::backoff(CoopWaitList::waking(self));
+            continue;
+        }
 #endif
-                return false;
-            }
-            CoopTaskBase::delay(ms - expired);
+        pendingTasks.settle(self);
+        const auto pendingTask = loadPending();
+        // a task that was woken up goes ahead of the queued tasks, a task that starts waiting queues behind them,
+        // neither takes the units that other woken tasks have claimed
+        const bool ahead = pendingTask == self ||
+            (!pendingTasks.contains(self) && (woken || (!pendingTask && pendingTasks.empty())));
+        if (ahead && takeValue(count, pendingTasks.claimed()))
+        {
+            leave(self);
+            return true;
         }
-        else
+        const uint32_t expired = withDeadline ? millis() - start : 0;
+        if (withDeadline && expired >= ms)
         {
-            CoopTaskBase::yield();
+            leave(self);
+            return false;
         }
-        selfFirst = true;
+        if (pendingTask != self) pendingTasks.push(self, count, woken);
+        // set before it can be published as pendingTask0, such that a post wakes it up
+        if (!withDeadline) self->sleep(true);
+        else self->timedSleep(ms - expired);
+        wakePending();
+#if defined(COOPTASK_MULTITHREAD)
+        lock.unlock();
+#endif
+        // sleeps until a post, or the deadline, wakes it up
+        CoopTaskBase::yield();
+        woken = true;
     }
 }
 
-bool IRAM_ATTR CoopSemaphore::post()
+void CoopWaitList::push(CoopTaskBase* task, unsigned count, bool front)
 {
-    CoopTaskBase* pendingTask;
-#if !defined(ESP32) && defined(ARDUINO)
+    auto& node = link(task);
+    if (node.waitList) return;
+    const auto level = task->getPriority();
+    node.waitList = this;
+    node.waitLevel = level;
+    node.waitCount = count;
+    if (front)
     {
-        InterruptLock lock;
-        unsigned val = value.load();
-        value.store(val + 1);
-        pendingTask = pendingTask0.load();
-        if (pendingTask) pendingTask0.store(nullptr);
+        node.waitPrev = nullptr;
+        node.waitNext = heads[level];
+        if (heads[level]) link(heads[level]).waitPrev = task;
+        else tails[level] = task;
+        heads[level] = task;
+    }
+    else
+    {
+        node.waitNext = nullptr;
+        node.waitPrev = tails[level];
+        if (tails[level]) link(tails[level]).waitNext = task;
+        else heads[level] = task;
+        tails[level] = task;
+    }
+    ++this->count;
+}
+
+CoopTaskBase* CoopWaitList::peek() const
+{
+    if (!count) return nullptr;
+    for (uint8_t level = CoopTaskBase::PRIORITYLEVELS; level--;)
+    {
+        if (heads[level]) return heads[level];
+    }
+    return nullptr;
+}
+
+CoopTaskBase* CoopWaitList::pop()
+{
+    auto task = peek();
+    if (task) remove(task);
+    return task;
+}
+
+void CoopWaitList::remove(CoopTaskBase* task)
+{
+    auto& node = link(task);
+    if (node.waitList != this) return;
+    const auto level = node.waitLevel;
+    if (node.waitPrev) link(node.waitPrev).waitNext = node.waitNext;
+    else heads[level] = node.waitNext;
+    if (node.waitNext) link(node.waitNext).waitPrev = node.waitPrev;
+    else tails[level] = node.waitPrev;
+    node.waitPrev = node.waitNext = nullptr;
+    node.waitList = nullptr;
+    --count;
+}
+
+void CoopWaitList::claim(CoopTaskBase* task)
+{
+    auto& node = link(task);
+    if (node.waitClaim) return;
+    node.waitClaim = true;
+    claims += node.waitCount;
+}
+
+void CoopWaitList::settle(CoopTaskBase* task)
+{
+    auto& node = link(task);
+    if (!node.waitClaim) return;
+    node.waitClaim = false;
+    claims -= node.waitCount;
+}
+
+#if defined(COOPTASK_MULTITHREAD)
+void CoopWaitList::chain(CoopTaskBase*& first, CoopTaskBase*& last, CoopTaskBase* task)
+{
+    auto& node = link(task);
+    node.wakeNext = nullptr;
+    node.waking.store(true, std::memory_order_relaxed);
+    if (last) link(last).wakeNext = task;
+    else first = task;
+    last = task;
+}
+
+void CoopWaitList::wake(CoopTaskBase* first)
+{
+    while (auto task = first)
+    {
+        auto& node = link(task);
+        first = node.wakeNext;
+        task->scheduleTask(true);
+        // from here on, the task may return from its wait, and exit
+        node.waking.store(false, std::memory_order_release);
     }
+}
+#endif
+
+CoopTaskBase* IRAM_ATTR CoopSemaphore::wakeablePending()
+{
+    // it remains pendingTask0, such that the queued tasks do not overtake it until it runs
+    auto pendingTask = loadPending();
+    return (pendingTask && pendingTask->suspended() && value.load() >= CoopWaitList::waitCount(pendingTask)) ?
+        pendingTask : nullptr;
+}
+
+CoopTaskBase* IRAM_ATTR CoopSemaphore::_post(unsigned count)
+{
+    addValue(count);
+    return wakeablePending();
+}
+
+bool IRAM_ATTR CoopSemaphore::post(unsigned count)
+{
+#if defined(COOPTASK_MULTITHREAD)
+    // no interrupt service routines on the host, the posting thread wakes up all tasks that can proceed
+    addValue(count);
+    WaitLock lock(*this);
+    wakePending();
+    return true;
 #else
-    unsigned val = 0;
-    while (!value.compare_exchange_weak(val, val + 1)) {}
-    pendingTask = pendingTask0.exchange(nullptr);
+    // pendingTask0 wakes up the other tasks that can proceed when it runs
+    auto pendingTask = _post(count);
+    return !pendingTask || pendingTask->scheduleTask(true);
 #endif
-    if (!pendingTask || !pendingTask->suspended()) return true;
-    return pendingTask->scheduleTask(true);
 }
 
-bool CoopSemaphore::setval(unsigned newVal)
+bool CoopSemaphore::handoff()
 {
-    CoopTaskBase* pendingTask = nullptr;
-    unsigned val;
-#if !defined(ESP32) && defined(ARDUINO)
+    auto pendingTask = _post();
+    if (!pendingTask) return true;
+#if !defined(_MSC_VER) && !defined(ESP32_FREERTOS)
+    if (CoopTaskBase::running())
     {
-        InterruptLock lock;
-        val = value.load();
-        value.store(newVal);
-        if (newVal > val)
-        {
-            pendingTask = pendingTask0.load();
-            pendingTask0.store(nullptr);
-        }
+        CoopTaskBase::handoff(pendingTask);
+        return true;
     }
-#else
-    val = value.exchange(newVal);
-    if (newVal > val) pendingTask = pendingTask0.exchange(nullptr);
 #endif
-    if (!pendingTask || !pendingTask->suspended()) return true;
     return pendingTask->scheduleTask(true);
 }
 
-bool CoopSemaphore::try_wait()
+bool CoopSemaphore::setval(unsigned newVal)
 {
     unsigned val;
 #if !defined(ESP32) && defined(ARDUINO)
     {
         InterruptLock lock;
         val = value.load();
-        if (val)
-        {
-            value.store(val - 1);
-        }
+        value.store(newVal);
     }
 #else
-    val = 1;
-    while (val && !value.compare_exchange_weak(val, val - 1)) {}
+    val = value.exchange(newVal);
+#endif
+    if (newVal <= val) return true;
+#if defined(COOPTASK_MULTITHREAD)
+    WaitLock lock(*this);
+    wakePending();
+    return true;
+#else
+    auto pendingTask = wakeablePending();
+    return !pendingTask || pendingTask->scheduleTask(true);
 #endif
-    return val;
+}
+
+bool CoopSemaphore::try_wait(unsigned count)
+{
+    return takeValue(count, 0);
 }
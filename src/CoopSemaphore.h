@@ -21,73 +21,210 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #define __CoopSemaphore_h
 
 #include "CoopTaskBase.h"
-#include <circular_queue.h>
+
+/// The tasks that wait on a CoopSemaphore, by priority, then in the order they started waiting.
+/// The tasks are linked into it by their CoopTaskWaitLink, such that the number of waiting tasks
+/// is unlimited, and queuing or removing a task takes constant time without allocations.
+/// It is not thread-safe, the waiters of a CoopSemaphore take turns on it.
+class CoopWaitList
+{
+public:
+    CoopWaitList() = default;
+    CoopWaitList(const CoopWaitList&) = delete;
+    CoopWaitList& operator=(const CoopWaitList&) = delete;
+
+    bool empty() const { return !count; }
+    size_t size() const { return count; }
+    /// Queues the task behind the waiting tasks of the same or a higher priority,
+    /// or with front set, ahead of those of the same priority.
+    /// A task that is queued already keeps its place.
+    /// @param count the number of units that the task waits for.
+    void push(CoopTaskBase* task, unsigned count = 1, bool front = false);
+    /// @returns: the first task of the highest priority, or nullptr if the list is empty.
+    CoopTaskBase* peek() const;
+    /// Removes the first task of the highest priority.
+    /// @returns: the removed task, or nullptr if the list is empty.
+    CoopTaskBase* pop();
+    /// Removes the task, if it is queued on this list.
+    void remove(CoopTaskBase* task);
+    bool contains(CoopTaskBase* task) const { return link(task).waitList == this; }
+    /// @returns: the number of units that the task waits for.
+    static unsigned waitCount(CoopTaskBase* task) { return link(task).waitCount; }
+
+    /// Records that the task is woken up to take its units, the others leave them to it.
+    void claim(CoopTaskBase* task);
+    /// Drops the claim of the task, when it runs again.
+    void settle(CoopTaskBase* task);
+    /// @returns: the number of units that woken tasks have claimed, and not yet taken.
+    unsigned claimed() const { return claims; }
+#if defined(COOPTASK_MULTITHREAD)
+    /// Appends the claimed task to the chain of tasks that wake() schedules, once the wait lock is released.
+    /// The task neither waits again nor returns from its wait until then.
+    static void chain(CoopTaskBase*& first, CoopTaskBase*& last, CoopTaskBase* task);
+    /// Schedules the chained tasks.
+    static void wake(CoopTaskBase* first);
+    /// @returns: the flag that is set while the task is chained.
+    static const std::atomic<bool>& waking(CoopTaskBase* task) { return link(task).waking; }
+#endif
+
+protected:
+    CoopTaskBase* heads[CoopTaskBase::PRIORITYLEVELS] = {};
+    CoopTaskBase* tails[CoopTaskBase::PRIORITYLEVELS] = {};
+    size_t count = 0;
+    unsigned claims = 0;
+    static CoopTaskWaitLink& link(CoopTaskBase* task) { return *task; }
+};
 
 /// A semaphore that is safe to use from CoopTasks.
+/// Pending tasks are woken up in the order of their priority, then in the order they started waiting.
 /// Only post() is safe to use from interrupt service routines,
 /// or concurrent OS threads that must synchronized with the singled thread running CoopTasks.
+/// With runCoopTasksOnWorkers(), tasks on different worker threads may also wait concurrently.
 class CoopSemaphore
 {
 protected:
     std::atomic<unsigned> value;
     std::atomic<CoopTaskBase*> pendingTask0;
-    circular_queue<CoopTaskBase*> pendingTasks;
-
-    // capture-less functions for iterators.
-    static void awakeAndSchedule(CoopTaskBase*&& task)
-    {
-        task->scheduleTask(true);
-    }
-    static bool notIsSelfTask(CoopTaskBase*& task)
+    CoopWaitList pendingTasks;
+#if defined(COOPTASK_MULTITHREAD)
+    // waiters on different worker threads take turns on pendingTasks, never across a yield
+    std::atomic<bool> waitLock;
+    // the tasks that were woken up under the wait lock, they are scheduled after releasing it
+    CoopTaskBase* wokenFirst = nullptr;
+    CoopTaskBase* wokenLast = nullptr;
+    class WaitLock
     {
-        return CoopTaskBase::self() != task;
-    }
+    public:
+        explicit WaitLock(CoopSemaphore& _sema) : sema(_sema)
+        {
+            while (sema.waitLock.exchange(true, std::memory_order_acquire)) backoff(sema.waitLock);
+        }
+        ~WaitLock() { unlock(); }
+        /// Releases the lock, then schedules the tasks that were woken up while holding it.
+        void unlock()
+        {
+            if (!locked) return;
+            locked = false;
+            auto woken = sema.wokenFirst;
+            sema.wokenFirst = sema.wokenLast = nullptr;
+            sema.waitLock.store(false, std::memory_order_release);
+            // the semaphore may be gone once the first task runs
+            CoopWaitList::wake(woken);
+        }
+        /// Waits until the flag is seen clear, briefly spinning, then giving up the timeslice,
+        /// such that a holder that was descheduled, or runs on the same core, can go on.
+        static void backoff(const std::atomic<bool>& flag);
+    protected:
+        CoopSemaphore& sema;
+        bool locked = true;
+    };
+#endif
+
+    // pendingTask0 is the waiting task that the next post wakes up, it is only ever set by waiters,
+    // posts from interrupt service routines or other threads wake it without touching pendingTasks
+    CoopTaskBase* IRAM_ATTR loadPending();
+    CoopTaskBase* IRAM_ATTR takePending();
+    bool IRAM_ATTR exchangePending(CoopTaskBase*& expected, CoopTaskBase* task);
+    void IRAM_ATTR addValue(unsigned count);
+    /// Decrements the semaphore value by count, if that leaves at least reserve.
+    bool IRAM_ATTR takeValue(unsigned count, unsigned reserve);
+
+    /// Wakes up as many pending tasks, by priority, as the unclaimed value suffices for,
+    /// and publishes the next one as pendingTask0. Must be called by the waiters in turn.
+    /// On Linux host builds, the woken tasks are scheduled once the wait lock is released.
+    void wakePending();
+
+    /// Ends the wait of the running task, the value that is left goes on to the next pending tasks.
+    void leave(CoopTaskBase* self);
 
+    /// @param count the number of units to acquire at once.
     /// @param withDeadline true: the ms parameter specifies the relative timeout for a successful
     /// aquisition of the semaphore.
     /// false: there is no deadline, the ms parameter is disregarded.
     /// @param ms the relative timeout measured in milliseconds.
     /// @returns: true if it sucessfully acquired the semaphore, either immediately or after sleeping.
-    /// false if the deadline expired, or the maximum number of pending tasks is exceeded.
-    bool _wait(const bool withDeadline = false, const uint32_t ms = 0);
+    /// false if the deadline expired.
+    bool _wait(const unsigned count, const bool withDeadline = false, const uint32_t ms = 0);
+
+    /// @returns: pendingTask0, if it is asleep and the semaphore value suffices for it, otherwise nullptr.
+    CoopTaskBase* IRAM_ATTR wakeablePending();
+
+    /// Increments the semaphore value by count.
+    /// @returns: the pending task that must be woken up, or nullptr.
+    CoopTaskBase* IRAM_ATTR _post(unsigned count = 1);
 
 public:
     /// @param val the initial value of the semaphore.
-    /// @param maxPending the maximum supported number of concurrently waiting tasks.
-    CoopSemaphore(unsigned val, size_t maxPending = 10) : value(val), pendingTask0(nullptr), pendingTasks(maxPending) {}
+    /// @param maxPending deprecated, the number of concurrently waiting tasks is unlimited. Accepted and ignored.
+    CoopSemaphore(unsigned val, size_t maxPending = 10) : value(val), pendingTask0(nullptr)
+#if defined(COOPTASK_MULTITHREAD)
+        , waitLock(false)
+#endif
+    {
+        (void)maxPending;
+    }
     CoopSemaphore(const CoopSemaphore&) = delete;
     CoopSemaphore& operator=(const CoopSemaphore&) = delete;
     ~CoopSemaphore()
     {
-        // wake up all queued tasks
-        pendingTasks.for_each(awakeAndSchedule);
+        // wake up all pending tasks
+        if (auto task = takePending()) task->scheduleTask(true);
+        while (auto task = pendingTasks.pop())
+        {
+            task->scheduleTask(true);
+        }
     }
 
     /// post() is the only operation that is allowed from an interrupt service routine,
     /// or a concurrent OS thread that is synchronized with the singled thread running CoopTasks.
-    bool IRAM_ATTR post();
+    /// @param count the number of units to release at once. The value changes in a single step,
+    /// and as many pending tasks are woken up as it suffices for, instead of one per unit.
+    bool IRAM_ATTR post(unsigned count = 1);
+
+    /// Like post(), but for use only in a running CoopTask function, scheduled by runCoopTasks().
+    /// If a pending task is woken up, the calling task yields and the CPU switches directly
+    /// to the woken task, instead of that running after its turn in the next scheduler pass.
+    /// Not allowed from interrupt service routines or concurrent OS threads.
+    bool handoff();
 
     /// @param newVal: the semaphore is immediately set to the specified value. if newVal is greater
     /// than the current semaphore value, the behavior is identical to as many post operations.
     bool setval(unsigned newVal);
 
     /// @returns: true if it sucessfully acquired the semaphore, either immediately or after sleeping.
-    /// false if the maximum number of pending tasks is exceeded.
     bool wait()
     {
-        return _wait();
+        return _wait(1);
     }
 
     /// @param ms the relative timeout, measured in milliseconds, for a successful aquisition of the semaphore.
     /// @returns: true if it sucessfully acquired the semaphore, either immediately or after sleeping.
-    /// false if the deadline expired, or the maximum number of pending tasks is exceeded.
+    /// false if the deadline expired.
     bool wait(uint32_t ms)
     {
-        return _wait(true, ms);
+        return _wait(1, true, ms);
+    }
+
+    /// Acquires count units at once, the task does not hold any of them while it waits for the rest.
+    /// Tasks waiting for fewer units do not overtake it.
+    /// @returns: true if it sucessfully acquired the semaphore, either immediately or after sleeping.
+    bool acquire(unsigned count)
+    {
+        return _wait(count);
+    }
+
+    /// @param count the number of units to acquire at once.
+    /// @param ms the relative timeout, measured in milliseconds, for a successful aquisition of the semaphore.
+    /// @returns: true if it sucessfully acquired the semaphore, either immediately or after sleeping.
+    /// false if the deadline expired.
+    bool acquire(unsigned count, uint32_t ms)
+    {
+        return _wait(count, true, ms);
     }
 
+    /// @param count the number of units to acquire at once.
     /// @returns: true if the semaphore was acquired immediately, otherwise false.
-    bool try_wait();
+    bool try_wait(unsigned count = 1);
 };
 
 #endif // __CoopSemaphore_h
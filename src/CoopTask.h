@@ -21,6 +21,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #define __CoopTask_h
 
 #include "BasicCoopTask.h"
+#include "CoopScheduler.h"
 
 template<typename Result = int, class StackAllocator = CoopTaskStackAllocator> class CoopTask : public BasicCoopTask<StackAllocator>
 {
@@ -28,12 +29,12 @@ public:
     using taskfunction_t = Delegate< Result() >;
 
 #if defined(ARDUINO)
-    CoopTask(const String& name, CoopTask::taskfunction_t _func, size_t stackSize = BasicCoopTask<StackAllocator>::DEFAULTTASKSTACKSIZE) :
+    CoopTask(String name, CoopTask::taskfunction_t _func, size_t stackSize = BasicCoopTask<StackAllocator>::DEFAULTTASKSTACKSIZE) :
 #else
-    CoopTask(const std::string& name, CoopTask::taskfunction_t _func, size_t stackSize = BasicCoopTask<StackAllocator>::DEFAULTTASKSTACKSIZE) :
+    CoopTask(std::string name, CoopTask::taskfunction_t _func, size_t stackSize = BasicCoopTask<StackAllocator>::DEFAULTTASKSTACKSIZE) :
 #endif
         // Wrap _func into _exit() to capture return value as exit code
-        BasicCoopTask<StackAllocator>(name, captureFuncReturn, stackSize), func(_func)
+        BasicCoopTask<StackAllocator>(std::move(name), captureFuncReturn, stackSize), func(std::move(_func))
     {
     }
 
@@ -97,11 +98,11 @@ public:
     using CoopTaskBase::taskfunction_t;
 
 #if defined(ARDUINO)
-    CoopTask(const String& name, CoopTaskBase::taskfunction_t func, size_t stackSize = BasicCoopTask<StackAllocator>::DEFAULTTASKSTACKSIZE) :
+    CoopTask(String name, CoopTaskBase::taskfunction_t func, size_t stackSize = BasicCoopTask<StackAllocator>::DEFAULTTASKSTACKSIZE) :
 #else
-    CoopTask(const std::string& name, CoopTaskBase::taskfunction_t func, size_t stackSize = BasicCoopTask<StackAllocator>::DEFAULTTASKSTACKSIZE) :
+    CoopTask(std::string name, CoopTaskBase::taskfunction_t func, size_t stackSize = BasicCoopTask<StackAllocator>::DEFAULTTASKSTACKSIZE) :
 #endif
-        BasicCoopTask<StackAllocator>(name, func, stackSize)
+        BasicCoopTask<StackAllocator>(std::move(name), std::move(func), stackSize)
     {
     }
 
@@ -110,17 +111,198 @@ public:
 };
 
 /// A convenience function that creates a new CoopTask instance for the supplied task function, with the
-/// given name and stack size, and schedules it.
+/// given name, stack size, and priority level, and schedules it.
 /// @returns: the pointer to the new CoopTask instance, or nullptr if the creation or preparing for scheduling failed.
 template<typename Result = int, class StackAllocator = CoopTaskStackAllocator>
 CoopTask<Result, StackAllocator>* createCoopTask(
 #if defined(ARDUINO)
-    const String& name, typename CoopTask<Result, StackAllocator>::taskfunction_t func, size_t stackSize = CoopTaskBase::DEFAULTTASKSTACKSIZE)
+    String name, typename CoopTask<Result, StackAllocator>::taskfunction_t func, size_t stackSize = CoopTaskBase::DEFAULTTASKSTACKSIZE,
 #else
-const std::string& name, typename CoopTask<Result, StackAllocator>::taskfunction_t func, size_t stackSize = CoopTaskBase::DEFAULTTASKSTACKSIZE)
+std::string name, typename CoopTask<Result, StackAllocator>::taskfunction_t func, size_t stackSize = CoopTaskBase::DEFAULTTASKSTACKSIZE,
 #endif
+    uint8_t priority = 0)
 {
-    auto task = new CoopTask<Result, StackAllocator>(name, func, stackSize);
+    auto task = new CoopTask<Result, StackAllocator>(std::move(name), std::move(func), stackSize);
+    if (task) task->setPriority(priority);
+    if (task && task->scheduleTask()) return task;
+    delete task;
+    return nullptr;
+}
+
+/// A CoopTask that stores its task function by its concrete type F, like a lambda or a function pointer,
+/// without the type erasure of a Delegate. The task function is called directly from the task entry,
+/// and can be inlined there. The Result type is that of the task function.
+template<class F, class StackAllocator = CoopTaskStackAllocator, typename Result = decltype((*static_cast<F*>(nullptr))())>
+class InlineCoopTask : public BasicCoopTask<StackAllocator>
+{
+public:
+#if defined(ARDUINO)
+    InlineCoopTask(String name, F _func, size_t stackSize = BasicCoopTask<StackAllocator>::DEFAULTTASKSTACKSIZE) :
+#else
+    InlineCoopTask(std::string name, F _func, size_t stackSize = BasicCoopTask<StackAllocator>::DEFAULTTASKSTACKSIZE) :
+#endif
+        BasicCoopTask<StackAllocator>(std::move(name), CoopTaskBase::taskfunction_t(), stackSize), func(std::move(_func))
+    {
+    }
+
+protected:
+    Result _exitCode {};
+    F func;
+
+    void invokeTask() override
+    {
+#if !defined(ARDUINO)
+        try {
+#endif
+            _exitCode = func();
+#if !defined(ARDUINO)
+        }
+        catch (const Result code)
+        {
+            _exitCode = code;
+        }
+        catch (...)
+        {
+        }
+#endif
+    }
+    void _exit(Result&& code = Result{}) noexcept
+    {
+        _exitCode = std::move(code);
+        BasicCoopTask<StackAllocator>::_exit();
+    }
+    void _exit(const Result& code) noexcept
+    {
+        _exitCode = code;
+        BasicCoopTask<StackAllocator>::_exit();
+    }
+
+public:
+    /// @returns: The exit code is either the return value of of the task function, or set by using the exit() function.
+    Result exitCode() const noexcept { return _exitCode; }
+
+    /// @returns: a pointer to the InlineCoopTask instance that is running. nullptr if not called from a CoopTask function (running() == false).
+    static InlineCoopTask* self() noexcept { return static_cast<InlineCoopTask*>(BasicCoopTask<StackAllocator>::self()); }
+
+    /// Use only in running CoopTask function. As stack unwinding is corrupted
+    /// by exit(), using regular return or exceptions is to be preferred in most cases.
+    static void exit(Result&& code = Result{}) noexcept { self()->_exit(std::move(code)); }
+    static void exit(const Result& code) noexcept { self()->_exit(code); }
+};
+
+template<class F, class StackAllocator> class InlineCoopTask<F, StackAllocator, void> : public BasicCoopTask<StackAllocator>
+{
+public:
+#if defined(ARDUINO)
+    InlineCoopTask(String name, F _func, size_t stackSize = BasicCoopTask<StackAllocator>::DEFAULTTASKSTACKSIZE) :
+#else
+    InlineCoopTask(std::string name, F _func, size_t stackSize = BasicCoopTask<StackAllocator>::DEFAULTTASKSTACKSIZE) :
+#endif
+        BasicCoopTask<StackAllocator>(std::move(name), CoopTaskBase::taskfunction_t(), stackSize), func(std::move(_func))
+    {
+    }
+
+    /// @returns: a pointer to the InlineCoopTask instance that is running. nullptr if not called from a CoopTask function (running() == false).
+    static InlineCoopTask* self() noexcept { return static_cast<InlineCoopTask*>(BasicCoopTask<StackAllocator>::self()); }
+
+protected:
+    F func;
+
+    void invokeTask() override { func(); }
+};
+
+/// A convenience function that creates a new InlineCoopTask instance for the supplied task function, with the
+/// given name, stack size, and priority level, and schedules it.
+/// @returns: the pointer to the new InlineCoopTask instance, or nullptr if the creation or preparing for scheduling failed.
+template<class StackAllocator = CoopTaskStackAllocator, class F>
+InlineCoopTask<F, StackAllocator>* makeCoopTask(
+#if defined(ARDUINO)
+    String name, F func, size_t stackSize = CoopTaskBase::DEFAULTTASKSTACKSIZE,
+#else
+    std::string name, F func, size_t stackSize = CoopTaskBase::DEFAULTTASKSTACKSIZE,
+#endif
+    uint8_t priority = 0)
+{
+    auto task = new InlineCoopTask<F, StackAllocator>(std::move(name), std::move(func), stackSize);
+    if (task) task->setPriority(priority);
+    if (task && task->scheduleTask()) return task;
+    delete task;
+    return nullptr;
+}
+
+/// Draws the task objects of TaskType, for instance CoopTask<>, from a preallocated pool of Capacity objects,
+/// instead of the heap. Deleting a pooled task, like in the reaper of runCoopTasks(), returns its object to the pool.
+/// With a stack allocator like CoopTaskStackAllocatorAsMember or CoopTaskStackAllocatorPool, a function pointer,
+/// and a name that fits the small string buffer of String or std::string, creating a task does not allocate.
+/// @returns: new returns nullptr if the pool is exhausted.
+template<class TaskType, size_t Capacity>
+class PooledCoopTask : public TaskType
+{
+public:
+    using TaskType::TaskType;
+
+    static void* operator new(size_t size) noexcept
+    {
+        if (size > sizeof(Slot)) return nullptr;
+#if !defined(ARDUINO)
+        std::lock_guard<std::mutex> lock(poolMutex);
+#endif
+        Slot* slot = freeSlots;
+        if (slot) freeSlots = slot->next;
+        else if (usedSlots < Capacity) slot = &slots[usedSlots++];
+        return slot;
+    }
+    static void operator delete(void* ptr) noexcept
+    {
+        if (!ptr) return;
+#if !defined(ARDUINO)
+        std::lock_guard<std::mutex> lock(poolMutex);
+#endif
+        auto slot = static_cast<Slot*>(ptr);
+        slot->next = freeSlots;
+        freeSlots = slot;
+    }
+
+protected:
+    union Slot
+    {
+        Slot* next;
+        alignas(TaskType) char object[sizeof(TaskType)];
+    };
+    static Slot slots[Capacity];
+    static Slot* freeSlots;
+    static size_t usedSlots;
+#if !defined(ARDUINO)
+    static std::mutex poolMutex;
+#endif
+};
+
+template<class TaskType, size_t Capacity>
+typename PooledCoopTask<TaskType, Capacity>::Slot PooledCoopTask<TaskType, Capacity>::slots[Capacity];
+template<class TaskType, size_t Capacity>
+typename PooledCoopTask<TaskType, Capacity>::Slot* PooledCoopTask<TaskType, Capacity>::freeSlots = nullptr;
+template<class TaskType, size_t Capacity>
+size_t PooledCoopTask<TaskType, Capacity>::usedSlots = 0;
+#if !defined(ARDUINO)
+template<class TaskType, size_t Capacity>
+std::mutex PooledCoopTask<TaskType, Capacity>::poolMutex;
+#endif
+
+/// A convenience function that creates a new CoopTask instance from the pool of Capacity task objects
+/// for the supplied task function, with the given name, stack size, and priority level, and schedules it.
+/// @returns: the pointer to the new PooledCoopTask instance, or nullptr if the pool is exhausted,
+/// or the creation or preparing for scheduling failed.
+template<size_t Capacity, typename Result = int, class StackAllocator = CoopTaskStackAllocator>
+PooledCoopTask<CoopTask<Result, StackAllocator>, Capacity>* createPooledCoopTask(
+#if defined(ARDUINO)
+    String name, typename CoopTask<Result, StackAllocator>::taskfunction_t func, size_t stackSize = CoopTaskBase::DEFAULTTASKSTACKSIZE,
+#else
+    std::string name, typename CoopTask<Result, StackAllocator>::taskfunction_t func, size_t stackSize = CoopTaskBase::DEFAULTTASKSTACKSIZE,
+#endif
+    uint8_t priority = 0)
+{
+    auto task = new PooledCoopTask<CoopTask<Result, StackAllocator>, Capacity>(std::move(name), std::move(func), stackSize);
+    if (task) task->setPriority(priority);
     if (task && task->scheduleTask()) return task;
     delete task;
     return nullptr;
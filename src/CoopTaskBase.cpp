@@ -18,10 +18,26 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
 #include "CoopTaskBase.h"
+#include "CoopScheduler.h"
 #ifdef ARDUINO
 #include <alloca.h>
 #else
 #include <chrono>
+#include <algorithm>
+#include <cstring>
+#endif
+#if defined(__linux__) && !defined(ARDUINO)
+#include <sys/mman.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+#include <ctime>
+#include <climits>
+#include <thread>
+#include <condition_variable>
 #endif
 
 #if defined(ESP8266)
@@ -93,28 +109,47 @@ extern "C" {
 #endif // ESP32_FREERTOS
 }
 
-std::array< std::atomic<CoopTaskBase* >, CoopTaskBase::MAXNUMBERCOOPTASKS + 1> CoopTaskBase::runnableTasks {};
-std::atomic<size_t> CoopTaskBase::runnableTasksCount(0);
+COOPTASK_THREADLOCAL CoopTaskBase* CoopTaskBase::handoffTask = nullptr;
 
-CoopTaskBase* CoopTaskBase::current = nullptr;
+COOPTASK_THREADLOCAL CoopTaskBase* CoopTaskBase::current = nullptr;
 
 #ifndef ARDUINO
 namespace
 {
+    uint64_t monotonicMicros()
+    {
+#if defined(__linux__)
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#else
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    // the time at the beginning of the current scheduler pass
     uint32_t millis()
     {
-        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        return static_cast<uint32_t>(CoopTaskBase::passTime() / 1000);
     }
     uint32_t micros()
     {
-        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        return static_cast<uint32_t>(CoopTaskBase::passTime());
     }
-    void delayMicroseconds(uint32_t us)
+    // the current time, delays start at it so that they never expire early
+    uint32_t clockMillis()
     {
-        const uint32_t start = micros();
-        while (micros() - start < us) {}
+        return static_cast<uint32_t>(CoopTaskBase::clockNow() / 1000);
+    }
+    uint32_t clockMicros()
+    {
+        return static_cast<uint32_t>(CoopTaskBase::clockNow());
     }
 }
+
+CoopTaskBase::clocksource_t CoopTaskBase::clockSource = monotonicMicros;
+COOPTASK_THREADLOCAL uint64_t CoopTaskBase::passClock = 0;
+COOPTASK_THREADLOCAL bool CoopTaskBase::passClockValid = false;
 #elif defined(ESP8266) || defined(ESP32)
 namespace
 {
@@ -122,6 +157,127 @@ namespace
 }
 #endif
 
+#ifndef ARDUINO
+void CoopTaskBase::siftTimer(std::vector<CoopTaskBase*>& timers, size_t pos)
+{
+    // deadlines are compared wrap-around safe, all pending deadlines are within DELAY_MAXINT of each other
+    auto task = timers[pos];
+    while (pos > 0)
+    {
+        const size_t parent = (pos - 1) / 2;
+        if (static_cast<int32_t>(task->timerDeadline - timers[parent]->timerDeadline) >= 0) break;
+        timers[pos] = timers[parent];
+        timers[pos]->timerIndex = pos;
+        pos = parent;
+    }
+    for (;;)
+    {
+        size_t child = 2 * pos + 1;
+        if (child >= timers.size()) break;
+        if (child + 1 < timers.size() &&
+            static_cast<int32_t>(timers[child + 1]->timerDeadline - timers[child]->timerDeadline) < 0) ++child;
+        if (static_cast<int32_t>(timers[child]->timerDeadline - task->timerDeadline) >= 0) break;
+        timers[pos] = timers[child];
+        timers[pos]->timerIndex = pos;
+        pos = child;
+    }
+    timers[pos] = task;
+    task->timerIndex = pos;
+}
+
+void CoopTaskBase::insertTimer()
+{
+    removeTimer();
+    timerIsMs = delay_ms;
+    timerPrioritized = priority > 0;
+    if (timerPrioritized) ++home().prioritizedTimers;
+    // longer delays are re-evaluated by run() after DELAY_MAXINT
+    timerDeadline = delay_start + (delay_duration > DELAY_MAXINT ? DELAY_MAXINT : delay_duration);
+    auto& timers = timerIsMs ? home().delayedTasksMs : home().delayedTasksUs;
+    timers.push_back(this);
+    siftTimer(timers, timers.size() - 1);
+}
+
+void CoopTaskBase::removeTimer()
+{
+    if (NOINDEX == timerIndex) return;
+    if (timerPrioritized) --home().prioritizedTimers;
+    auto& timers = timerIsMs ? home().delayedTasksMs : home().delayedTasksUs;
+    const size_t pos = timerIndex;
+    timerIndex = NOINDEX;
+    auto last = timers.back();
+    timers.pop_back();
+    if (last != this)
+    {
+        timers[pos] = last;
+        siftTimer(timers, pos);
+    }
+}
+
+void CoopTaskBase::expireTimers(RunQueue& rq)
+{
+    auto& delayedTasksMs = rq.delayedTasksMs;
+    auto& delayedTasksUs = rq.delayedTasksUs;
+    if (!delayedTasksMs.empty())
+    {
+        const uint32_t now = millis();
+        while (!delayedTasksMs.empty() && static_cast<int32_t>(delayedTasksMs.front()->timerDeadline - now) <= 0)
+        {
+            auto task = delayedTasksMs.front();
+            task->removeTimer();
+            task->enqueueReady();
+        }
+    }
+    if (!delayedTasksUs.empty())
+    {
+        const uint32_t now = micros();
+        // the remainder below DELAYMICROS_THRESHOLD is waited for in the ready queue
+        while (!delayedTasksUs.empty() && static_cast<int32_t>(delayedTasksUs.front()->timerDeadline - now) < DELAYMICROS_THRESHOLD)
+        {
+            auto task = delayedTasksUs.front();
+            task->removeTimer();
+            task->enqueueReady();
+        }
+    }
+}
+
+bool CoopTaskBase::hasRunnableReady(const RunQueue& rq)
+{
+    for (auto head : rq.readyHead)
+    {
+        for (auto task = head; task; task = task->readyNext)
+        {
+            if (!task->delayed()) return true;
+        }
+    }
+    return false;
+}
+
+void CoopTaskBase::spinUntil(const RunQueue& rq, uint64_t deadline)
+{
+    while (static_cast<int64_t>(deadline - clockNow()) > 0 && rq.inboxEmpty()) {}
+}
+
+uint32_t CoopTaskBase::nextTimerDelay(const RunQueue& rq)
+{
+    const auto& delayedTasksMs = rq.delayedTasksMs;
+    const auto& delayedTasksUs = rq.delayedTasksUs;
+    uint32_t delay_ms = ~0U;
+    if (!delayedTasksMs.empty())
+    {
+        const int32_t delay_rem = delayedTasksMs.front()->timerDeadline - clockMillis();
+        delay_ms = delay_rem > 0 ? delay_rem : 0;
+    }
+    if (!delayedTasksUs.empty())
+    {
+        const int32_t delay_rem = delayedTasksUs.front()->timerDeadline - clockMicros();
+        const uint32_t delayUs_ms = delay_rem > 0 ? delay_rem / 1000 : 0;
+        if (delayUs_ms < delay_ms) delay_ms = delayUs_ms;
+    }
+    return delay_ms;
+}
+#endif // ARDUINO
+
 #if defined(ESP8266)
 bool CoopTaskBase::usingBuiltinScheduler = false;
 
@@ -153,10 +309,48 @@ bool CoopTaskBase::rescheduleTask(uint32_t repeat_us)
 }
 #endif
 
+CoopScheduler* CoopTaskBase::boundScheduler()
+{
+    return &CoopScheduler::current();
+}
+
+const CoopTaskBase::runnabletasks_t& CoopTaskBase::getRunnableTasks()
+{
+    return CoopScheduler::current().getRunnableTasks();
+}
+
+size_t CoopTaskBase::getRunnableTasksCount()
+{
+    return CoopScheduler::current().getRunnableTasksCount();
+}
+
 bool IRAM_ATTR CoopTaskBase::enrollRunnable()
 {
+    // an enrolled task keeps its slot until it exits or gets deleted, waking it up doesn't scan
+    if (NOINDEX != runnableIndex) return true;
+    auto& runnableTasks = scheduler->runnableTasks;
+    auto& runnableTasksCount = scheduler->runnableTasksCount;
+#ifndef ARDUINO
+    auto& freeRunnableSlots = scheduler->freeRunnableSlots;
+    std::lock_guard<std::mutex> lock(scheduler->runnableTasksMutex);
+    if (NOINDEX != runnableIndex) return true;
+    if (freeRunnableSlots.empty())
+    {
+        runnableIndex = runnableTasks.size();
+        runnableTasks.emplace_back(this);
+    }
+    else
+    {
+        runnableIndex = freeRunnableSlots.back();
+        freeRunnableSlots.pop_back();
+        runnableTasks[runnableIndex].store(this);
+    }
+    ++runnableTasksCount;
+    return true;
+#else
     bool enrolled = false;
     bool inserted = false;
+    size_t index = runnableTasks.size();
     for (size_t i = 0; i < runnableTasks.size(); ++i)
     {
 #if !defined(ESP32) && defined(ARDUINO)
@@ -167,6 +361,7 @@ bool IRAM_ATTR CoopTaskBase::enrollRunnable()
             runnableTasks[i].store(this);
             enrolled = true;
             inserted = true;
+            index = i;
         }
         else if (this == task)
         {
@@ -178,67 +373,857 @@ bool IRAM_ATTR CoopTaskBase::enrollRunnable()
             else
             {
                 enrolled = true;
+                index = i;
+            }
+            break;
+        }
+    }
+    if (inserted)
+    {
+        InterruptLock lock;
+        runnableTasksCount.store(runnableTasksCount.load() + 1);
+    }
+#else
+        CoopTaskBase* cmpTo = nullptr;
+        if (!enrolled && runnableTasks[i].compare_exchange_strong(cmpTo, this))
+        {
+            enrolled = true;
+            inserted = true;
+            index = i;
+        }
+        else if (enrolled)
+        {
+            cmpTo = this;
+            if (runnableTasks[i].compare_exchange_strong(cmpTo, nullptr))
+            {
+                inserted = false;
+                break;
+            }
+        }
+        else if (this == runnableTasks[i].load())
+        {
+            enrolled = true;
+            index = i;
+            break;
+        }
+    }
+    if (inserted) ++runnableTasksCount;
+#endif
+    if (enrolled) runnableIndex = index;
+    return enrolled;
+#endif
+}
+
+void CoopTaskBase::delistRunnable()
+{
+    auto& runnableTasks = scheduler->runnableTasks;
+    auto& runnableTasksCount = scheduler->runnableTasksCount;
+#ifndef ARDUINO
+    removeTimer();
+    std::lock_guard<std::mutex> lock(scheduler->runnableTasksMutex);
+#endif
+    const auto index = runnableIndex;
+    if (NOINDEX == index) return;
+    runnableIndex = NOINDEX;
+#ifndef ARDUINO
+    runnableTasks[index].store(nullptr);
+    scheduler->freeRunnableSlots.push_back(index);
+    --runnableTasksCount;
+#elif !defined(ESP32)
+    InterruptLock lock;
+    if (runnableTasks[index].load() == this)
+    {
+        runnableTasks[index].store(nullptr);
+        runnableTasksCount.store(runnableTasksCount.load() - 1);
+    }
+#else
+    CoopTaskBase* self = this;
+    if (runnableTasks[index].compare_exchange_strong(self, nullptr))
+    {
+        --runnableTasksCount;
+    }
+#endif
+}
+
+void IRAM_ATTR CoopTaskBase::enqueueReady()
+{
+#if !defined(ESP32) && defined(ARDUINO)
+    {
+        InterruptLock lock;
+        if (readyQueued.load()) return;
+        readyQueued.store(true);
+    }
+#else
+    if (readyQueued.exchange(true)) return;
+#endif
+#if defined(COOPTASK_MULTITHREAD)
+    // the task is neither queued nor running, no other thread accesses homeQueue now
+    pushReady(homeQueue ? *homeQueue : *assignQueue());
+#else
+    home().pushInbox(this);
+#endif
+}
+
+void IRAM_ATTR CoopTaskBase::RunQueue::pushInbox(CoopTaskInboxLink* link)
+{
+    link->inboxNext.store(nullptr);
+    CoopTaskInboxLink* prev;
+#if !defined(ESP32) && defined(ARDUINO)
+    {
+        InterruptLock lock;
+        prev = inboxBack.load();
+        inboxBack.store(link);
+    }
+#else
+    prev = inboxBack.exchange(link);
+#endif
+    // until this store, the scheduler sees the inbox end at prev
+    prev->inboxNext.store(link);
+}
+
+CoopTaskBase* CoopTaskBase::RunQueue::popInbox()
+{
+    auto front = inboxFront;
+    auto next = front->inboxNext.load();
+    if (front == &inboxStub)
+    {
+        if (!next) return nullptr;
+        inboxFront = front = next;
+        next = next->inboxNext.load();
+    }
+    if (!next)
+    {
+        // a producer has not yet linked in the task that follows
+        if (front != inboxBack.load()) return nullptr;
+        // the last task is only taken once another link follows it
+        pushInbox(&inboxStub);
+        next = front->inboxNext.load();
+        if (!next) return nullptr;
+    }
+    inboxFront = next;
+    return static_cast<CoopTaskBase*>(front);
+}
+
+#if defined(COOPTASK_MULTITHREAD)
+void IRAM_ATTR CoopTaskBase::pushReady(RunQueue& target)
+{
+    target.pushInbox(this);
+    if (target.parked.load()) target.unpark();
+}
+
+void CoopTaskBase::RunQueue::park(uint32_t ms)
+{
+    const uint32_t seq = unparks.load();
+    parked.store(true);
+    if (ioWaits)
+    {
+        parkedIo.store(true);
+        if (inboxEmpty()) pollIo(~0U == ms ? -1 : static_cast<int>(std::min<uint32_t>(ms, INT_MAX)));
+        parkedIo.store(false);
+    }
+    // a task pushed before parked was set has not unparked this queue
+    else if (inboxEmpty())
+    {
+        timespec timeout;
+        if (~0U != ms)
+        {
+            // deadlines are whole milliseconds of the clock, the current one has partially elapsed
+            const uint64_t us = static_cast<uint64_t>(ms) * 1000 - clockNow() % 1000;
+            timeout.tv_sec = us / 1000000;
+            timeout.tv_nsec = (us % 1000000) * 1000;
+        }
+        // the timeout of FUTEX_WAIT is relative, measured by CLOCK_MONOTONIC
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&unparks), FUTEX_WAIT_PRIVATE, seq,
+            ~0U != ms ? &timeout : nullptr, nullptr, 0);
+    }
+    parked.store(false);
+}
+
+void IRAM_ATTR CoopTaskBase::RunQueue::unpark()
+{
+    ++unparks;
+    if (parkedIo.load())
+    {
+        const uint64_t one = 1;
+        if (write(wakeFd, &one, sizeof(one))) {}
+        return;
+    }
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&unparks), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+
+struct CoopTaskBase::FileOp
+{
+    uint8_t opcode;
+    int fd;
+    void* buf;
+    size_t count;
+    off_t offset;
+    CoopTaskBase* task;
+    // the count of bytes, or -errno
+    ssize_t result;
+    // 0: pending, 1: waking up the task, 2: completed, the task may return from fileIo() and release it
+    std::atomic<uint8_t> state;
+    // stages the buffers that are on a shared stack, which other tasks overwrite while the operation is in progress
+    char* staging;
+    size_t stagingSize;
+    ~FileOp() { delete[] staging; }
+};
+
+struct CoopTaskBase::RunQueue::FileRing
+{
+    static constexpr unsigned ENTRIES = 256;
+    int fd = -1;
+    io_uring_params params {};
+    void* sqRing = MAP_FAILED;
+    void* cqRing = MAP_FAILED;
+    void* sqesMap = MAP_FAILED;
+    size_t sqRingSize = 0;
+    size_t cqRingSize = 0;
+    io_uring_sqe* sqes = nullptr;
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe* cqes = nullptr;
+    // the operations that are queued in the ring, but not submitted yet, and those not completed yet
+    unsigned unsubmitted = 0;
+    unsigned inFlight = 0;
+
+    ~FileRing()
+    {
+        if (sqesMap != MAP_FAILED) munmap(sqesMap, params.sq_entries * sizeof(io_uring_sqe));
+        if (cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqRingSize);
+        if (sqRing != MAP_FAILED) munmap(sqRing, sqRingSize);
+        if (fd >= 0) close(fd);
+    }
+
+    bool open(int eventFd)
+    {
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, ENTRIES, &params));
+        // reads and writes at the file position need Linux 5.6
+        if (fd < 0 || !(params.features & IORING_FEAT_RW_CUR_POS)) return false;
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED) return false;
+        cqRing = (params.features & IORING_FEAT_SINGLE_MMAP) ? sqRing :
+            mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) return false;
+        sqesMap = mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqesMap == MAP_FAILED) return false;
+        sqes = static_cast<io_uring_sqe*>(sqesMap);
+        const auto sq = static_cast<char*>(sqRing);
+        sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        // each slot of the submission queue refers to the entry of the same index
+        const auto array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        for (unsigned i = 0; i < params.sq_entries; ++i) array[i] = i;
+        const auto cq = static_cast<char*>(cqRing);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        // completions signal the eventfd that the run queue blocks on in epoll_wait
+        return syscall(__NR_io_uring_register, fd, IORING_REGISTER_EVENTFD, &eventFd, 1) == 0;
+    }
+
+    void submit()
+    {
+        if (!unsubmitted) return;
+        const auto submitted = syscall(__NR_io_uring_enter, fd, unsubmitted, 0, 0, nullptr, 0);
+        // on EAGAIN or EBUSY, the remaining operations are submitted by the next poll
+        if (submitted > 0) unsubmitted -= static_cast<unsigned>(submitted);
+    }
+};
+
+CoopTaskBase::RunQueue::~RunQueue()
+{
+    delete fileRing;
+    if (epollFd >= 0) close(epollFd);
+    if (wakeFd >= 0) close(wakeFd);
+}
+
+bool CoopTaskBase::RunQueue::openIo()
+{
+    if (epollFd >= 0) return true;
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) return false;
+    wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    epoll_event event {};
+    event.events = EPOLLIN;
+    event.data.fd = wakeFd;
+    if (wakeFd < 0 || epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event) < 0)
+    {
+        if (wakeFd >= 0) close(wakeFd);
+        close(epollFd);
+        wakeFd = epollFd = -1;
+        return false;
+    }
+    return true;
+}
+
+bool CoopTaskBase::RunQueue::watchIo(int fd, bool read, CoopTaskBase* task)
+{
+    if (!openIo()) return false;
+    auto& watch = ioWatches[fd];
+    auto& waiter = read ? watch.reader : watch.writer;
+    if (waiter) return false;
+    const bool added = !watch.reader && !watch.writer;
+    waiter = task;
+    if (!updateIo(fd, watch, added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD))
+    {
+        waiter = nullptr;
+        if (added) ioWatches.erase(fd);
+        return false;
+    }
+    ++ioWaits;
+    return true;
+}
+
+void CoopTaskBase::RunQueue::unwatchIo(int fd, bool read)
+{
+    auto it = ioWatches.find(fd);
+    if (it == ioWatches.end()) return;
+    auto& waiter = read ? it->second.reader : it->second.writer;
+    if (!waiter) return;
+    waiter = nullptr;
+    --ioWaits;
+    if (!updateIo(fd, it->second, EPOLL_CTL_MOD)) ioWatches.erase(it);
+}
+
+bool CoopTaskBase::RunQueue::updateIo(int fd, const IoWatch& watch, int op)
+{
+    epoll_event event {};
+    event.events = (watch.reader ? static_cast<uint32_t>(EPOLLIN) : 0u) | (watch.writer ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+    event.data.fd = fd;
+    if (!event.events)
+    {
+        // fails harmlessly if fd has been closed, which removes it from the epoll set
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, &event);
+        return false;
+    }
+    return epoll_ctl(epollFd, op, fd, &event) == 0;
+}
+
+void CoopTaskBase::RunQueue::pollIo(int timeout_ms)
+{
+    // the file operations that the tasks have started since the last poll
+    if (fileRing) fileRing->submit();
+    epoll_event events[64];
+    const int count = epoll_wait(epollFd, events, 64, timeout_ms);
+    for (int i = 0; i < count; ++i)
+    {
+        const int fd = events[i].data.fd;
+        if (fd == wakeFd)
+        {
+            uint64_t wakeups;
+            if (read(wakeFd, &wakeups, sizeof(wakeups))) {}
+            continue;
+        }
+        auto it = ioWatches.find(fd);
+        if (it == ioWatches.end()) continue;
+        auto& watch = it->second;
+        const auto ready = events[i].events;
+        for (auto waiter : { &watch.reader, &watch.writer })
+        {
+            if (!*waiter || !(ready & (EPOLLERR | EPOLLHUP | (waiter == &watch.reader ? EPOLLIN : EPOLLOUT)))) continue;
+            auto task = *waiter;
+            *waiter = nullptr;
+            --ioWaits;
+            task->ioReady = true;
+            task->ioWaiting = false;
+            task->scheduleTask(true);
+        }
+        if (!updateIo(fd, watch, EPOLL_CTL_MOD)) ioWatches.erase(it);
+    }
+    reapFiles();
+}
+
+bool CoopTaskBase::waitIo(int fd, bool read, uint32_t ms) noexcept
+{
+    auto& rq = home();
+    ioReady = false;
+    if (!rq.watchIo(fd, read, this)) return false;
+    ioWaiting = true;
+    if (~0U == ms) _sleep();
+    else _delay(ms);
+    if (!ioReady)
+    {
+        // timed out, or woken up otherwise, the task has stayed on the same run queue
+        ioWaiting = false;
+        rq.unwatchIo(fd, read);
+    }
+    return ioReady;
+}
+
+bool CoopTaskBase::RunQueue::submitFile(FileOp* op)
+{
+    if (!fileRingTried)
+    {
+        fileRingTried = true;
+        auto ring = new FileRing();
+        if (openIo() && ring->open(wakeFd)) fileRing = ring;
+        else delete ring;
+    }
+    // at most as many operations are in flight as their completions fit into the ring
+    if (!fileRing || fileRing->inFlight >= fileRing->params.cq_entries) return false;
+    auto& ring = *fileRing;
+    const unsigned tail = *ring.sqTail;
+    if (tail - __atomic_load_n(ring.sqHead, __ATOMIC_ACQUIRE) >= ring.params.sq_entries)
+    {
+        ring.submit();
+        if (tail - __atomic_load_n(ring.sqHead, __ATOMIC_ACQUIRE) >= ring.params.sq_entries) return false;
+    }
+    auto& sqe = ring.sqes[tail & ring.sqMask];
+    ::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = op->opcode;
+    sqe.fd = op->fd;
+    if (IORING_OP_FSYNC != op->opcode)
+    {
+        sqe.addr = reinterpret_cast<uintptr_t>(op->buf);
+        // like read() and write(), a single operation transfers at most 0x7ffff000 bytes
+        sqe.len = static_cast<uint32_t>(std::min<size_t>(op->count, 0x7ffff000));
+        // -1 is the file position
+        sqe.off = static_cast<uint64_t>(op->offset < 0 ? -1 : op->offset);
+    }
+    sqe.user_data = reinterpret_cast<uintptr_t>(op);
+    __atomic_store_n(ring.sqTail, tail + 1, __ATOMIC_RELEASE);
+    ++ring.unsubmitted;
+    ++ring.inFlight;
+    ++ioWaits;
+    return true;
+}
+
+void CoopTaskBase::RunQueue::reapFiles()
+{
+    if (!fileRing) return;
+    auto& ring = *fileRing;
+    unsigned head = *ring.cqHead;
+    const unsigned tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+    if (head == tail) return;
+    for (; head != tail; ++head)
+    {
+        const auto& cqe = ring.cqes[head & ring.cqMask];
+        --ring.inFlight;
+        --ioWaits;
+        completeFile(reinterpret_cast<FileOp*>(static_cast<uintptr_t>(cqe.user_data)), cqe.res);
+    }
+    __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+}
+
+namespace
+{
+    ssize_t performFile(uint8_t opcode, int fd, void* buf, size_t count, off_t offset)
+    {
+        ssize_t result;
+        switch (opcode)
+        {
+        case IORING_OP_READ:
+            result = offset < 0 ? ::read(fd, buf, count) : ::pread(fd, buf, count, offset);
+            break;
+        case IORING_OP_WRITE:
+            result = offset < 0 ? ::write(fd, buf, count) : ::pwrite(fd, buf, count, offset);
+            break;
+        default:
+            result = ::fsync(fd);
+            break;
+        }
+        return result < 0 ? -errno : result;
+    }
+
+    // performs the file operations of tasks if io_uring is not available
+    class FilePool
+    {
+    public:
+        static constexpr unsigned THREADS = 4;
+        ~FilePool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wakeup.notify_all();
+            for (auto& thread : threads) thread.join();
+        }
+        void push(Delegate<void()>&& job)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                jobs.push_back(std::move(job));
+                if (threads.size() < THREADS && jobs.size() > idle)
+                    threads.emplace_back(&FilePool::work, this);
+            }
+            wakeup.notify_one();
+        }
+    private:
+        std::mutex mutex;
+        std::condition_variable wakeup;
+        std::deque<Delegate<void()>> jobs;
+        std::vector<std::thread> threads;
+        size_t idle = 0;
+        bool stopping = false;
+        void work()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            for (;;)
+            {
+                ++idle;
+                wakeup.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                --idle;
+                if (jobs.empty()) return;
+                auto job = std::move(jobs.front());
+                jobs.pop_front();
+                lock.unlock();
+                job();
+                lock.lock();
+            }
+        }
+    };
+
+    FilePool& filePool()
+    {
+        static FilePool pool;
+        return pool;
+    }
+}
+
+void CoopTaskBase::completeFile(FileOp* op, ssize_t result)
+{
+    const auto task = op->task;
+    op->result = result;
+    op->state.store(1);
+    task->scheduleTask(true);
+    op->state.store(2);
+}
+
+ssize_t CoopTaskBase::fileIo(uint8_t opcode, int fd, void* buf, size_t count, off_t offset) noexcept
+{
+    const auto task = self();
+    ssize_t result;
+    if (!task)
+    {
+        result = performFile(opcode, fd, buf, count, offset);
+    }
+    else
+    {
+        if (!task->fileOp) task->fileOp = new FileOp();
+        const auto op = task->fileOp;
+        const bool staged = task->sharedStack && static_cast<char*>(buf) >= task->taskStackTop && static_cast<char*>(buf) < task->stackEnd();
+        if (staged)
+        {
+            count = std::min<size_t>(count, 0x7ffff000);
+            if (count > op->stagingSize)
+            {
+                delete[] op->staging;
+                op->stagingSize = (count + 63) & ~static_cast<size_t>(63);
+                op->staging = new char[op->stagingSize];
             }
+            if (IORING_OP_WRITE == opcode) ::memcpy(op->staging, buf, count);
+        }
+        op->opcode = opcode;
+        op->fd = fd;
+        op->buf = staged ? op->staging : buf;
+        op->count = count;
+        op->offset = offset;
+        op->task = task;
+        op->result = 0;
+        op->state.store(0);
+        if (!task->home().submitFile(op))
+        {
+            filePool().push([op]() { completeFile(op, performFile(op->opcode, op->fd, op->buf, op->count, op->offset)); });
+        }
+        // the buffer is in use until the operation completes, also if the task is woken up otherwise
+        for (;;)
+        {
+            auto state = op->state.load();
+            if (!state)
+            {
+                // the completion wakes up the task after it has changed the state
+                task->sleep(true);
+                state = op->state.load();
+                if (state) task->sleep(false);
+            }
+            if (2 == state) break;
+            task->_yield();
+        }
+        result = op->result;
+        if (staged && IORING_OP_READ == opcode && result > 0) ::memcpy(buf, op->staging, result);
+    }
+    if (result >= 0) return result;
+    errno = static_cast<int>(-result);
+    return -1;
+}
+
+ssize_t CoopTaskBase::coopRead(int fd, void* buf, size_t count, off_t offset) noexcept
+{
+    return fileIo(IORING_OP_READ, fd, buf, count, offset);
+}
+
+ssize_t CoopTaskBase::coopWrite(int fd, const void* buf, size_t count, off_t offset) noexcept
+{
+    return fileIo(IORING_OP_WRITE, fd, const_cast<void*>(buf), count, offset);
+}
+
+int CoopTaskBase::coopFsync(int fd) noexcept
+{
+    return static_cast<int>(fileIo(IORING_OP_FSYNC, fd, nullptr, 0, 0));
+}
+
+CoopTaskBase::RunQueue* IRAM_ATTR CoopTaskBase::assignQueue()
+{
+    const auto& workerQueues = scheduler->workerQueues;
+    if (workerQueues.empty()) return &scheduler->runQueue;
+    size_t worker;
+    if (sharedStack)
+    {
+        if (!sharedStack->pinned)
+        {
+            sharedStack->worker = scheduler->nextWorker++ % workerQueues.size();
+            sharedStack->pinned = true;
+        }
+        worker = sharedStack->worker % workerQueues.size();
+    }
+    else if (current && current->scheduler == scheduler && current->homeQueue)
+    {
+        // a task that is created by a task starts on the same worker
+        return homeQueue = current->homeQueue;
+    }
+    else
+    {
+        worker = scheduler->nextWorker++ % workerQueues.size();
+    }
+    return homeQueue = workerQueues[worker];
+}
+#endif
+
+void CoopTaskBase::takeReadyInbox(RunQueue& rq)
+{
+    if (rq.inboxEmpty()) return;
+    while (auto task = rq.popInbox())
+    {
+        rq.appendReady(task);
+    }
+}
+
+void CoopTaskBase::RunQueue::appendReady(CoopTaskBase* task)
+{
+    const auto level = task->priority;
+    CoopTaskBase* prev = readyTail[level];
+    if (prev && task->hasDeadline && task->scheduler->earliestDeadlineFirst())
+    {
+        // ordered by deadline, ahead of the tasks without one
+        prev = nullptr;
+        for (auto next = readyHead[level]; next && next->hasDeadline && !task->deadlineBefore(*next); next = next->readyNext)
+            prev = next;
+    }
+    if (prev)
+    {
+        task->readyNext = prev->readyNext;
+        prev->readyNext = task;
+    }
+    else
+    {
+        task->readyNext = readyHead[level];
+        readyHead[level] = task;
+    }
+    if (!task->readyNext) readyTail[level] = task;
+#if defined(COOPTASK_MULTITHREAD)
+    ++readyLength;
+#endif
+}
+
+bool CoopTaskBase::RunQueue::hasReady() const
+{
+    for (auto head : readyHead)
+    {
+        if (head) return true;
+    }
+    return false;
+}
+
+void CoopTaskBase::beginPass(RunQueue& rq)
+{
+    takeReadyInbox(rq);
+    for (uint8_t level = 0; level < PRIORITYLEVELS; ++level)
+    {
+        rq.passHead[level] = rq.readyHead[level];
+        rq.readyHead[level] = nullptr;
+        rq.readyTail[level] = nullptr;
+    }
+    rq.bypasses = 0;
+#if defined(COOPTASK_MULTITHREAD)
+    rq.passLength.store(rq.readyLength, std::memory_order_relaxed);
+    rq.readyLength = 0;
+#endif
+}
+
+CoopTaskBase* CoopTaskBase::nextPassTask(RunQueue& rq)
+{
+#ifndef ARDUINO
+    if (rq.prioritizedTimers)
+    {
+        // the delays of prioritized tasks do not wait for the end of the pass to expire
+        passClock = clockSource();
+        expireTimers(rq);
+    }
+#endif
+    takeReadyInbox(rq);
+    int top = PRIORITYLEVELS - 1;
+    while (top >= 0 && !rq.passHead[top]) --top;
+    if (top < 0) return nullptr;
+    CoopTaskBase* task = nullptr;
+    if (rq.bypasses < PRIORITYAGING)
+    {
+        // a task that has become ready at a higher priority than the remaining tasks of the pass runs first
+        for (int level = PRIORITYLEVELS - 1; level > top; --level)
+        {
+            task = rq.readyHead[level];
+            if (!task) continue;
+            rq.readyHead[level] = task->readyNext;
+            if (!rq.readyHead[level]) rq.readyTail[level] = nullptr;
+#if defined(COOPTASK_MULTITHREAD)
+            --rq.readyLength;
+#endif
+            ++rq.bypasses;
             break;
         }
+        // with earliest-deadline-first ordering, also a ready task of the same priority with an earlier deadline
+        auto ready = rq.readyHead[top];
+        if (!task && ready && ready->hasDeadline && ready->scheduler->earliestDeadlineFirst() &&
+            (!rq.passHead[top]->hasDeadline || ready->deadlineBefore(*rq.passHead[top])))
+        {
+            task = ready;
+            rq.readyHead[top] = task->readyNext;
+            if (!rq.readyHead[top]) rq.readyTail[top] = nullptr;
+#if defined(COOPTASK_MULTITHREAD)
+            --rq.readyLength;
+#endif
+            ++rq.bypasses;
+        }
     }
-    if (inserted)
+    if (!task)
     {
-        InterruptLock lock;
-        runnableTasksCount.store(runnableTasksCount.load() + 1);
+        task = rq.passHead[top];
+        rq.passHead[top] = task->readyNext;
+        rq.bypasses = 0;
+#if defined(COOPTASK_MULTITHREAD)
+        rq.passLength.store(rq.passLength.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+#endif
     }
-#else
-        CoopTaskBase* cmpTo = nullptr;
-        if (!enrolled && runnableTasks[i].compare_exchange_strong(cmpTo, this))
-        {
-            enrolled = true;
-            inserted = true;
-        }
-        else if (enrolled)
+    task->readyNext = nullptr;
+#ifndef ARDUINO
+    // a task that was woken up before its deadline leaves the timer queue
+    task->removeTimer();
+#endif
+    return task;
+}
+
+void CoopTaskBase::requeue(int32_t runResult)
+{
+    if (runResult >= 0)
+    {
+#ifndef ARDUINO
+        // a delay that expires within DELAYMICROS_THRESHOLD microseconds keeps the task in the ready queue
+        if (runResult > 0 && delayed() && (delay_ms || runResult >= DELAYMICROS_THRESHOLD))
         {
-            cmpTo = this;
-            if (runnableTasks[i].compare_exchange_strong(cmpTo, nullptr))
-            {
-                inserted = false;
-                break;
-            }
+            insertTimer();
         }
-        else if (this == runnableTasks[i].load())
+        else
+#endif
+        if (!sleeping())
         {
-            enrolled = true;
-            break;
+            // stays marked as queued, appended directly for the next pass
+            home().appendReady(this);
+            return;
         }
     }
-    if (inserted) ++runnableTasksCount;
+#if defined(COOPTASK_MULTITHREAD)
+    // an exited task is no longer bound to the worker, whose run queue ends with runCoopTasksOnWorkers()
+    if (runResult < 0) homeQueue = nullptr;
 #endif
-    return enrolled;
+    readyQueued.store(false);
+    // a concurrent wakeup found the task still marked as queued, repeat it
+    if (runResult >= 0 && !suspended()) enqueueReady();
 }
 
-void CoopTaskBase::delistRunnable()
+void CoopTaskBase::unlinkReady()
 {
-#if !defined(ESP32) && defined(ARDUINO)
-    InterruptLock lock;
-    for (size_t i = 0; i < runnableTasks.size(); ++i)
+    if (!readyQueued.load()) return;
+    auto& rq = home();
+    takeReadyInbox(rq);
+    for (uint8_t level = 0; level < PRIORITYLEVELS; ++level)
     {
-        if (runnableTasks[i].load() == this)
+        for (auto list : { &rq.passHead[level], &rq.readyHead[level] })
         {
-            runnableTasks[i].store(nullptr);
-            runnableTasksCount.store(runnableTasksCount.load() - 1);
-            break;
+            CoopTaskBase* prev = nullptr;
+            for (auto task = *list; task; prev = task, task = task->readyNext)
+            {
+                if (task != this) continue;
+                if (prev) prev->readyNext = readyNext;
+                else *list = readyNext;
+                if (list == &rq.readyHead[level] && rq.readyTail[level] == this) rq.readyTail[level] = prev;
+#if defined(COOPTASK_MULTITHREAD)
+                if (list == &rq.readyHead[level]) --rq.readyLength;
+                else rq.passLength.store(rq.passLength.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+#endif
+                readyNext = nullptr;
+                readyQueued.store(false);
+                return;
+            }
         }
     }
-#else
-    for (size_t i = 0; i < runnableTasks.size(); ++i)
+    readyQueued.store(false);
+}
+
+#if defined(COOPTASK_MULTITHREAD)
+void CoopTaskBase::shareReadyTasks(RunQueue& rq)
+{
+    auto thief = rq.stealRequest.exchange(nullptr);
+    if (!thief) return;
+    takeReadyInbox(rq);
+    for (uint8_t level = 0; level < PRIORITYLEVELS; ++level)
     {
-        CoopTaskBase* self = this;
-        if (runnableTasks[i].compare_exchange_strong(self, nullptr))
+        for (auto list : { &rq.passHead[level], &rq.readyHead[level] })
         {
-            --runnableTasksCount;
-            break;
+            CoopTaskBase* prev = nullptr;
+            bool give = true;
+            for (auto task = *list; task;)
+            {
+                auto next = task->readyNext;
+                give = !give;
+                // tasks on a shared stack stay on the worker that it is pinned to,
+                // a task that still watches a file descriptor stays on the worker that polls it
+                if (!give || task->sharedStack || task->ioWaiting)
+                {
+                    prev = task;
+                    task = next;
+                    continue;
+                }
+                if (prev) prev->readyNext = next;
+                else *list = next;
+                if (list == &rq.readyHead[level])
+                {
+                    if (rq.readyTail[level] == task) rq.readyTail[level] = prev;
+                    --rq.readyLength;
+                }
+                else
+                {
+                    rq.passLength.store(rq.passLength.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+                }
+                // still marked as queued, concurrent wakeups leave it alone while it moves
+                task->removeTimer();
+                task->homeQueue = thief;
+                task->pushReady(*thief);
+                task = next;
+            }
         }
     }
-#endif
 }
+#endif
 
 bool IRAM_ATTR CoopTaskBase::scheduleTask(bool wakeup)
 {
@@ -251,25 +1236,62 @@ bool IRAM_ATTR CoopTaskBase::scheduleTask(bool wakeup)
         sleep(false);
     }
 #if defined(ESP8266)
+    if (!usingBuiltinScheduler) enqueueReady();
     return !reschedule || schedule_function([this]() { rescheduleTask(1); });
 #else
+    // must follow the wakeup, the scheduler drops sleeping tasks from the ready queue
+    enqueueReady();
     return true;
 #endif
 }
 
+void IRAM_ATTR CoopTaskBase::timedSleep(uint32_t ms) noexcept
+{
+    delay_ms = true;
+#ifdef ESP8266
+    delay_start = usingBuiltinScheduler ? millis() : ESP.getCycleCount();
+#elif ESP32
+    delay_start = ESP.getCycleCount();
+#elif !defined(ARDUINO)
+    delay_start = clockMillis();
+#else
+    delay_start = millis();
+#endif
+    delay_duration = ms;
+    // set last, a wakeup that clears it ends the delay
+    delays.store(true);
+}
+
+void CoopTaskBase::_delayUntil(uint32_t ms) noexcept
+{
+#ifndef ARDUINO
+    // the delay starts at the clock reading that it is computed from, and ends at the deadline
+    const uint32_t now = clockMillis();
+    const int32_t delay_rem = ms - now;
+    delay_ms = true;
+    delay_start = now;
+    delay_duration = delay_rem > 0 ? delay_rem : 0;
+    doYield(3);
+#else
+    const int32_t delay_rem = ms - millis();
+    _delay(delay_rem > 0 ? delay_rem : 0);
+#endif
+}
+
 #if defined(_MSC_VER)
 
 CoopTaskBase::~CoopTaskBase()
 {
     if (taskFiber) DeleteFiber(taskFiber);
     delistRunnable();
+    unlinkReady();
 }
 
 LPVOID CoopTaskBase::primaryFiber = nullptr;
 
 void __stdcall CoopTaskBase::taskFiberFunc(void* self)
 {
-    static_cast<CoopTaskBase*>(self)->func();
+    static_cast<CoopTaskBase*>(self)->invokeTask();
     static_cast<CoopTaskBase*>(self)->_exit();
 }
 
@@ -313,11 +1335,7 @@ int32_t CoopTaskBase::run()
             if (expired < delay_duration)
             {
                 auto delay_rem = delay_duration - expired;
-                if (delay_rem >= DELAYMICROS_THRESHOLD)
-                {
-                    return static_cast<int32_t>(delay_rem) < 0 ? DELAY_MAXINT : delay_rem;
-                }
-                ::delayMicroseconds(delay_rem);
+                return static_cast<int32_t>(delay_rem) < 0 ? DELAY_MAXINT : delay_rem;
             }
         }
         delays.store(false);
@@ -342,6 +1360,9 @@ int32_t CoopTaskBase::run()
     switch (val)
     {
     case 1:
+        // yielded after timedSleep(), unless woken up in the meantime
+        if (delays.load()) return static_cast<int32_t>(delay_duration) < 0 ? DELAY_MAXINT : delay_duration;
+        return 0;
     case 2:
         return 0;
         break;
@@ -366,7 +1387,7 @@ void CoopTaskBase::doYield(unsigned val) noexcept
 void CoopTaskBase::_delay(uint32_t ms) noexcept
 {
     delay_ms = true;
-    delay_start = millis();
+    delay_start = clockMillis();
     delay_duration = ms;
     // CoopTask::run() defers task for delay_duration milliseconds.
     doYield(3);
@@ -374,12 +1395,8 @@ void CoopTaskBase::_delay(uint32_t ms) noexcept
 
 void CoopTaskBase::_delayMicroseconds(uint32_t us) noexcept
 {
-    if (us < DELAYMICROS_THRESHOLD) {
-        ::delayMicroseconds(us);
-        return;
-    }
     delay_ms = false;
-    delay_start = micros();
+    delay_start = clockMicros();
     delay_duration = us;
     // CoopTask::run() defers task for delay_duration microseconds.
     doYield(3);
@@ -418,11 +1435,12 @@ CoopTaskBase::~CoopTaskBase()
     if (taskHandle) vTaskDelete(taskHandle);
     taskHandle = nullptr;
     delistRunnable();
+    unlinkReady();
 }
 
 void CoopTaskBase::taskFunc(void* _self)
 {
-    static_cast<CoopTaskBase*>(_self)->func();
+    static_cast<CoopTaskBase*>(_self)->invokeTask();
     static_cast<CoopTaskBase*>(_self)->_exit();
 }
 
@@ -629,6 +1647,7 @@ CoopTaskBase* CoopTaskBase::self() noexcept
     const auto currentTaskHandle = xTaskGetCurrentTaskHandle();
     auto cur = current;
     if (cur && currentTaskHandle == cur->taskHandle) return cur;
+    const auto& runnableTasks = CoopScheduler::current().getRunnableTasks();
     for (size_t i = 0; i < runnableTasks.size(); ++i)
     {
         cur = runnableTasks[i].load();
@@ -639,22 +1658,222 @@ CoopTaskBase* CoopTaskBase::self() noexcept
 
 #else
 
-jmp_buf CoopTaskBase::env;
+#if defined(COOPTASK_ASMCONTEXT)
+extern "C" {
+    // Pushes the callee-saved registers onto the current stack and stores the stack pointer to *from,
+    // then switches to the stack pointer to, and pops the registers of the context saved there.
+    // The floating-point control state is not switched, a task that changes it must restore it before yielding.
+    void coop_switch_context(void** from, void* to);
+    // The return address in the initial context of a task. Calls the function from the second
+    // register slot with the value of the first register slot as argument.
+    void coop_context_entry();
+}
+
+#if defined(__x86_64__)
+asm(R"(
+    .text
+    .globl coop_switch_context
+    .hidden coop_switch_context
+    .type coop_switch_context, @function
+    .p2align 4
+coop_switch_context:
+    pushq %rbp
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    popq %rbp
+    ret
+    .size coop_switch_context, .-coop_switch_context
+
+    .globl coop_context_entry
+    .hidden coop_context_entry
+    .type coop_context_entry, @function
+    .p2align 4
+coop_context_entry:
+    .cfi_startproc
+    .cfi_undefined rip
+    movq %r12, %rdi
+    callq *%r13
+    ud2
+    .cfi_endproc
+    .size coop_context_entry, .-coop_context_entry
+)");
+#elif defined(__aarch64__)
+asm(R"(
+    .text
+    .globl coop_switch_context
+    .hidden coop_switch_context
+    .type coop_switch_context, %function
+    .p2align 4
+coop_switch_context:
+    sub sp, sp, #0xa0
+    stp d8, d9, [sp, #0x00]
+    stp d10, d11, [sp, #0x10]
+    stp d12, d13, [sp, #0x20]
+    stp d14, d15, [sp, #0x30]
+    stp x19, x20, [sp, #0x40]
+    stp x21, x22, [sp, #0x50]
+    stp x23, x24, [sp, #0x60]
+    stp x25, x26, [sp, #0x70]
+    stp x27, x28, [sp, #0x80]
+    stp x29, x30, [sp, #0x90]
+    mov x9, sp
+    str x9, [x0]
+    mov sp, x1
+    ldp d8, d9, [sp, #0x00]
+    ldp d10, d11, [sp, #0x10]
+    ldp d12, d13, [sp, #0x20]
+    ldp d14, d15, [sp, #0x30]
+    ldp x19, x20, [sp, #0x40]
+    ldp x21, x22, [sp, #0x50]
+    ldp x23, x24, [sp, #0x60]
+    ldp x25, x26, [sp, #0x70]
+    ldp x27, x28, [sp, #0x80]
+    ldp x29, x30, [sp, #0x90]
+    add sp, sp, #0xa0
+    ret
+    .size coop_switch_context, .-coop_switch_context
+
+    .globl coop_context_entry
+    .hidden coop_context_entry
+    .type coop_context_entry, %function
+    .p2align 4
+coop_context_entry:
+    .cfi_startproc
+    .cfi_undefined x30
+    mov x0, x19
+    blr x20
+    brk #0
+    .cfi_endproc
+    .size coop_context_entry, .-coop_context_entry
+)");
+#endif
+
+COOPTASK_THREADLOCAL void* CoopTaskBase::env = nullptr;
+
+void CoopTaskBase::taskFunc(void* _self)
+{
+    static_cast<CoopTaskBase*>(_self)->invokeTask();
+    static_cast<CoopTaskBase*>(_self)->_exit();
+}
+#else
+COOPTASK_THREADLOCAL jmp_buf CoopTaskBase::env;
+#endif
+
+#if defined(COOPTASK_MULTITHREAD)
+// a task may resume on another worker thread, the address of current must not be cached across a yield
+__attribute__((noinline)) CoopTaskBase* CoopTaskBase::self() noexcept
+{
+    return current;
+}
+#endif
 
 CoopTaskBase::~CoopTaskBase()
 {
     delistRunnable();
+    unlinkReady();
+    if (sharedStack && sharedStack->owner == this) sharedStack->owner = nullptr;
+    delete[] sharedStackSave;
+#if defined(COOPTASK_REACTOR)
+    delete fileOp;
+#endif
+}
+
+char* CoopTaskBase::liveStack() const
+{
+#if defined(COOPTASK_ASMCONTEXT)
+    return static_cast<char*>(env_yield);
+#else
+    return liveStackBottom;
+#endif
+}
+
+void CoopTaskBase::acquireSharedStack()
+{
+    auto owner = sharedStack->owner;
+    if (owner == this) return;
+    // an exited or killed task never resumes, its stack need not be saved
+    if (owner && owner->cont && owner->init)
+    {
+        const size_t live = owner->stackEnd() - owner->liveStack();
+        if (live > owner->sharedStackSaveSize)
+        {
+            delete[] owner->sharedStackSave;
+            owner->sharedStackSaveSize = (live + 63) & ~static_cast<size_t>(63);
+#if defined(ESP8266)
+            owner->sharedStackSave = new (std::nothrow) char[owner->sharedStackSaveSize];
+#else
+            owner->sharedStackSave = new char[owner->sharedStackSaveSize];
+#endif
+            if (!owner->sharedStackSave)
+            {
+#if !defined(ARDUINO_attiny)
+                ::printf(PSTR("FATAL ERROR: CoopTask %s shared stack cannot be saved\n"), owner->name().c_str());
+#endif
+                ::abort();
+            }
+        }
+        ::memcpy(owner->sharedStackSave, owner->liveStack(), live);
+    }
+    sharedStack->owner = this;
+    if (init)
+    {
+        ::memcpy(liveStack(), sharedStackSave, stackEnd() - liveStack());
+    }
 }
 
 int32_t CoopTaskBase::initialize()
 {
     if (!cont || init) return -1;
     init = true;
-    // fill stack with magic values to check overflow, corruption, and high water mark
-    for (size_t pos = 0; pos <= (taskStackSize + (FULLFEATURES ? sizeof(STACKCOOKIE) : 0)) / sizeof(STACKCOOKIE); ++pos)
+    if (sharedStack)
+    {
+        // other tasks' frames are live on a shared stack, only its bounds hold cookies
+        *reinterpret_cast<unsigned*>(taskStackTop) = STACKCOOKIE;
+        if (FULLFEATURES) *reinterpret_cast<unsigned*>(taskStackTop + taskStackSize + sizeof(STACKCOOKIE)) = STACKCOOKIE;
+    }
+    // fill stack with magic values to check overflow, corruption, and high water mark,
+    // a guarded stack traps on overflow and its pages are committed only when touched
+    else if (!stackGuarded())
     {
-        reinterpret_cast<unsigned*>(taskStackTop)[pos] = STACKCOOKIE;
+        for (size_t pos = taskStackPainted / sizeof(STACKCOOKIE); pos <= (taskStackSize + (FULLFEATURES ? sizeof(STACKCOOKIE) : 0)) / sizeof(STACKCOOKIE); ++pos)
+        {
+            reinterpret_cast<unsigned*>(taskStackTop)[pos] = STACKCOOKIE;
+        }
     }
+#if defined(COOPTASK_ASMCONTEXT)
+    // build the initial context, as saved by coop_switch_context(), that returns into coop_context_entry()
+    auto stackBottom = reinterpret_cast<uintptr_t*>(
+        ((reinterpret_cast<long unsigned>(taskStackTop) + taskStackSize + (FULLFEATURES ? sizeof(STACKCOOKIE) : 0)) >> 4) << 4);
+#if defined(__x86_64__)
+    // slots: r15, r14, r13, r12, rbx, rbp, return address, null frame
+    auto sp = stackBottom - 9;
+    sp[0] = sp[1] = 0;
+    sp[2] = reinterpret_cast<uintptr_t>(&taskFunc);
+    sp[3] = reinterpret_cast<uintptr_t>(this);
+    sp[4] = sp[5] = 0;
+    sp[6] = reinterpret_cast<uintptr_t>(&coop_context_entry);
+    sp[7] = sp[8] = 0;
+#elif defined(__aarch64__)
+    // slots: d8-d15, x19-x28, x29, x30, null frame record
+    auto sp = stackBottom - 22;
+    for (size_t slot = 0; slot < 22; ++slot) sp[slot] = 0;
+    sp[8] = reinterpret_cast<uintptr_t>(this);
+    sp[9] = reinterpret_cast<uintptr_t>(&taskFunc);
+    sp[19] = reinterpret_cast<uintptr_t>(&coop_context_entry);
+#endif
+    env_yield = sp;
+    return 0;
+#else
 #if defined(__GNUC__) && (defined(__amd64__) || defined(__amd64) || defined(__x86_64__) || defined(__x86_64))
     asm volatile (
         "movq %0, %%rsp"
@@ -669,11 +1888,12 @@ int32_t CoopTaskBase::initialize()
 #else
 #error Setting stack pointer is not implemented on this target
 #endif
-    func();
+    invokeTask();
     self()->_exit();
     cont = false;
     delistRunnable();
     return -1;
+#endif
 }
 
 int32_t CoopTaskBase::run()
@@ -717,22 +1937,45 @@ int32_t CoopTaskBase::run()
             if (expired < delay_duration)
             {
                 auto delay_rem = delay_duration - expired;
+#ifdef ARDUINO
                 if (delay_rem >= DELAYMICROS_THRESHOLD)
                 {
                     return static_cast<int32_t>(delay_rem) < 0 ? DELAY_MAXINT : delay_rem;
                 }
                 ::delayMicroseconds(delay_rem);
+#else
+                // the scheduler runs other tasks meanwhile, also if delay_rem is below DELAYMICROS_THRESHOLD
+                return static_cast<int32_t>(delay_rem) < 0 ? DELAY_MAXINT : delay_rem;
+#endif
             }
         }
         delays.store(false);
         delay_duration = 0;
     }
+#if defined(COOPTASK_ASMCONTEXT)
+    current = this;
+    if (sharedStack) acquireSharedStack();
+    if (!init && initialize() < 0)
+    {
+        current = nullptr;
+        return -1;
+    }
+    if (FULLFEATURES && !stackGuarded() && *reinterpret_cast<unsigned*>(taskStackTop + taskStackSize + sizeof(STACKCOOKIE)) != STACKCOOKIE)
+    {
+        ::printf(PSTR("FATAL ERROR: CoopTask %s stack corrupted\n"), name().c_str());
+        ::abort();
+    }
+    // val = -1: exit() task; 1: yield task; 2: sleep task; 3: delay task for delay_duration
+    coop_switch_context(&env, env_yield);
+    {
+#else
     auto val = setjmp(env);
     // val = 0: init; -1: exit() task; 1: yield task; 2: sleep task; 3: delay task for delay_duration
     if (!val) {
         current = this;
+        if (sharedStack) acquireSharedStack();
         if (!init) return initialize();
-        if (FULLFEATURES && *reinterpret_cast<unsigned*>(taskStackTop + taskStackSize + sizeof(STACKCOOKIE)) != STACKCOOKIE)
+        if (FULLFEATURES && !stackGuarded() && *reinterpret_cast<unsigned*>(taskStackTop + taskStackSize + sizeof(STACKCOOKIE)) != STACKCOOKIE)
         {
 #if !defined(ARDUINO_attiny)
             ::printf(PSTR("FATAL ERROR: CoopTask %s stack corrupted\n"), name().c_str());
@@ -744,18 +1987,30 @@ int32_t CoopTaskBase::run()
     }
     else
     {
+#endif
+        // after a handoff, another task than this one returns control
+        auto task = current;
         current = nullptr;
-        if (*reinterpret_cast<unsigned*>(taskStackTop) != STACKCOOKIE)
-        {
+#if defined(COOPTASK_ASMCONTEXT)
+        return task->afterYield(task->val);
+#else
+        return task->afterYield(val);
+#endif
+    }
+}
+
+int32_t CoopTaskBase::afterYield(int val)
+{
+    if (!stackGuarded() && *reinterpret_cast<unsigned*>(taskStackTop) != STACKCOOKIE)
+    {
 #if !defined(ARDUINO_attiny)
-            ::printf(PSTR("FATAL ERROR: CoopTask %s stack overflow\n"), name().c_str());
+        ::printf(PSTR("FATAL ERROR: CoopTask %s stack overflow\n"), name().c_str());
 #endif
-            ::abort();
-        }
-        cont = cont && (val > 0);
-        sleeps.store(sleeps.load() || (val == 2));
-        delays.store(delays.load() || (val > 2));
+        ::abort();
     }
+    cont = cont && (val > 0);
+    if (val == 2) sleeps.store(true);
+    else if (val > 2) delays.store(true);
     if (!cont) {
         delistRunnable();
         return -1;
@@ -763,6 +2018,9 @@ int32_t CoopTaskBase::run()
     switch (val)
     {
     case 1:
+        // yielded after timedSleep(), unless woken up in the meantime
+        if (delays.load()) return static_cast<int32_t>(delay_duration) < 0 ? DELAY_MAXINT : delay_duration;
+        return 0;
     case 2:
         return 0;
         break;
@@ -775,13 +2033,8 @@ int32_t CoopTaskBase::run()
 
 void CoopTaskBase::dumpStack() const
 {
-    if (!taskStackTop) return;
-    size_t pos;
-    for (pos = 1; pos < (taskStackSize + (FULLFEATURES ? sizeof(STACKCOOKIE) : 0)) / sizeof(STACKCOOKIE); ++pos)
-    {
-        if (STACKCOOKIE != reinterpret_cast<unsigned*>(taskStackTop)[pos])
-            break;
-    }
+    if (!taskStackTop || (sharedStack && sharedStack->owner != this)) return;
+    size_t pos = getFreeStack() / sizeof(STACKCOOKIE) + 1;
 #if !defined(ARDUINO_attiny)
     ::printf(PSTR(">>>stack>>>\n"));
 #endif
@@ -806,6 +2059,31 @@ void CoopTaskBase::dumpStack() const
 size_t CoopTaskBase::getFreeStack() const
 {
     if (!taskStackTop) return 0;
+    if (sharedStack)
+    {
+        // the free stack at the task's last switch
+        return liveStack() ? liveStack() - taskStackTop - sizeof(STACKCOOKIE) : taskStackSize;
+    }
+#if defined(__linux__) && !defined(ARDUINO)
+    if (stackGuarded())
+    {
+        // the pages below the high water mark have never been touched, and are not resident
+        static const size_t pageSize = ::sysconf(_SC_PAGESIZE);
+        const size_t pages = (taskStackSize + pageSize - 1) / pageSize;
+        size_t page = 0;
+        unsigned char resident[64];
+        while (page < pages)
+        {
+            const size_t count = std::min(pages - page, sizeof(resident));
+            if (::mincore(taskStackTop + page * pageSize, count * pageSize, resident)) return 0;
+            size_t i = 0;
+            while (i < count && !(resident[i] & 1)) ++i;
+            page += i;
+            if (i < count) break;
+        }
+        return std::min(page * pageSize, taskStackSize);
+    }
+#endif
     size_t pos;
     for (pos = 1; pos < (taskStackSize + (FULLFEATURES ? sizeof(STACKCOOKIE) : 0)) / sizeof(STACKCOOKIE); ++pos)
     {
@@ -815,12 +2093,79 @@ size_t CoopTaskBase::getFreeStack() const
     return (pos - 1) * sizeof(unsigned);
 }
 
+#if !defined(COOPTASK_ASMCONTEXT)
+namespace
+{
+    // the frame of a called function lies below all of the caller's live stack
+    __attribute__((noinline)) char* calleeFrame()
+    {
+        return static_cast<char*>(__builtin_frame_address(0));
+    }
+}
+#endif
+
 void CoopTaskBase::doYield(unsigned val) noexcept
 {
+#if defined(COOPTASK_ASMCONTEXT)
+    this->val = val;
+    coop_switch_context(&env_yield, env);
+#else
+    if (sharedStack) liveStackBottom = calleeFrame();
     if (!setjmp(env_yield))
     {
         longjmp(env, val);
     }
+#endif
+}
+
+void CoopTaskBase::_handoff(CoopTaskBase* task) noexcept
+{
+    // only a task that is suspended in its own context, and not yet queued to run, is switched to directly
+    if (task == this || !task->init || !*task || (task->sharedStack && task->sharedStack->owner != task)
+        // a task that runs on another scheduler or worker is woken up on its own run queue
+        || &task->home() != &home()
+#if defined(ESP8266)
+        || usingBuiltinScheduler
+#endif
+        )
+    {
+        task->scheduleTask(true);
+        return;
+    }
+    task->sleep(false);
+#if !defined(ESP32) && defined(ARDUINO)
+    {
+        InterruptLock lock;
+        if (task->readyQueued.load()) return;
+        task->readyQueued.store(true);
+    }
+#else
+    if (task->readyQueued.exchange(true)) return;
+#endif
+#ifndef ARDUINO
+    task->removeTimer();
+#endif
+    if (!stackGuarded() && *reinterpret_cast<unsigned*>(taskStackTop) != STACKCOOKIE)
+    {
+#if !defined(ARDUINO_attiny)
+        ::printf(PSTR("FATAL ERROR: CoopTask %s stack overflow\n"), name().c_str());
+#endif
+        ::abort();
+    }
+    // this task has yielded, it goes to the ready queue like after run()
+    requeue(0);
+    handoffTask = task;
+    current = task;
+#if defined(COOPTASK_ASMCONTEXT)
+    coop_switch_context(&env_yield, task->env_yield);
+#else
+    // like in doYield(), the next task on the shared stack saves this task's stack from here
+    if (sharedStack) liveStackBottom = calleeFrame();
+    if (!setjmp(env_yield))
+    {
+        longjmp(task->env_yield, 1);
+    }
+#endif
 }
 
 void CoopTaskBase::_delay(uint32_t ms) noexcept
@@ -830,6 +2175,8 @@ void CoopTaskBase::_delay(uint32_t ms) noexcept
     delay_start = usingBuiltinScheduler ? millis() : ESP.getCycleCount();
 #elif ESP32
     delay_start = ESP.getCycleCount();
+#elif !defined(ARDUINO)
+    delay_start = clockMillis();
 #else
     delay_start = millis();
 #endif
@@ -840,12 +2187,18 @@ void CoopTaskBase::_delay(uint32_t ms) noexcept
 
 void CoopTaskBase::_delayMicroseconds(uint32_t us) noexcept
 {
+#ifdef ARDUINO
     if (us < DELAYMICROS_THRESHOLD) {
         ::delayMicroseconds(us);
         return;
     }
+#endif
     delay_ms = false;
+#ifndef ARDUINO
+    delay_start = clockMicros();
+#else
     delay_start = micros();
+#endif
     delay_duration = us;
     // CoopTask::run() defers task for delay_duration microseconds.
     doYield(3);
@@ -853,7 +2206,12 @@ void CoopTaskBase::_delayMicroseconds(uint32_t us) noexcept
 
 void CoopTaskBase::_exit() noexcept
 {
+#if defined(COOPTASK_ASMCONTEXT)
+    val = -1;
+    coop_switch_context(&env_yield, env);
+#else
     longjmp(env, -1);
+#endif
 }
 
 void CoopTaskBase::_yield() noexcept
@@ -877,72 +2235,3 @@ void IRAM_ATTR CoopTaskBase::sleep(const bool state) noexcept
 }
 
 #endif // _MSC_VER
-
-void runCoopTasks(const Delegate<void(const CoopTaskBase* const task)>& reaper,
-    const Delegate<bool(uint32_t ms)>& onDelay, const Delegate<bool()>& onSleep)
-{
-#ifdef ESP32_FREERTOS
-    static TaskHandle_t yieldGuardHandle = nullptr;
-    if (!yieldGuardHandle)
-    {
-        xTaskCreateUniversal([](void*)
-            {
-                for (;;)
-                {
-                    vPortYield();
-                }
-            }, "YieldGuard", 0x200, nullptr, 1, &yieldGuardHandle, CONFIG_ARDUINO_RUNNING_CORE);
-    }
-#endif
-
-    auto taskCount = CoopTaskBase::getRunnableTasksCount();
-    bool allSleeping = true;
-    uint32_t minDelay_ms = ~(decltype(minDelay_ms))0U;
-    for (size_t i = 0; taskCount && i < CoopTaskBase::getRunnableTasks().size(); ++i)
-    {
-#if defined(ESP8266) || defined(ESP32)
-        optimistic_yield(10000);
-#endif
-        auto task = CoopTaskBase::getRunnableTasks()[i].load();
-        if (task)
-        {
-            --taskCount;
-            auto runResult = task->run();
-            if (runResult < 0 && reaper)
-                reaper(task);
-            else if (minDelay_ms)
-            {
-                if (task->delayed())
-                {
-                    allSleeping = false;
-                    uint32_t delay_ms = task->delayIsMs() ? static_cast<uint32_t>(runResult) : static_cast<uint32_t>(runResult) / 1000UL;
-                    if (delay_ms < minDelay_ms)
-                        minDelay_ms = delay_ms;
-                }
-                else if (!task->sleeping())
-                {
-                    allSleeping = false;
-                    minDelay_ms = 0;
-                }
-            }
-        }
-    }
-
-    bool cleanup = true;
-    if (allSleeping && onSleep)
-    {
-        cleanup = onSleep();
-    }
-    else if (minDelay_ms && onDelay)
-    {
-        cleanup = onDelay(minDelay_ms);
-    }
-    if (cleanup)
-    {
-#ifdef ESP32_FREERTOS
-        vTaskSuspend(yieldGuardHandle);
-        vTaskDelay(1);
-        vTaskResume(yieldGuardHandle);
-#endif
-    }
-}
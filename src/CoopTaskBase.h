@@ -35,12 +35,18 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <Arduino.h>
 #elif defined(_MSC_VER)
 #include <array>
+#include <deque>
+#include <mutex>
 #include <Windows.h>
 #include <string>
+#include <vector>
 #else
 #include <array>
 #include <csetjmp>
+#include <deque>
+#include <mutex>
 #include <string>
+#include <vector>
 #endif
 
 #if !defined(ARDUINO) || defined(ESP8266) || defined(ESP32)
@@ -61,20 +67,102 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #define __attribute__(_)
 #endif
 
-class CoopTaskBase
+// On x86_64 and aarch64 Linux, tasks switch contexts by a minimal assembly routine that saves only
+// the callee-saved registers and the stack pointer. Define COOPTASK_SETJMP to use setjmp/longjmp instead.
+#if defined(__linux__) && defined(__GNUC__) && !defined(ARDUINO) && !defined(COOPTASK_SETJMP) && \
+    (defined(__x86_64__) || defined(__aarch64__))
+#define COOPTASK_ASMCONTEXT
+#endif
+
+// On Linux, a CoopScheduler can run its CoopTasks on a pool of threads, the task switching state is per thread.
+#if defined(__linux__) && !defined(ARDUINO)
+#define COOPTASK_MULTITHREAD
+#define COOPTASK_THREADLOCAL thread_local
+// On Linux, tasks can wait for file descriptors, which the scheduler polls by epoll,
+// and for file operations, which it submits to io_uring.
+#define COOPTASK_REACTOR
+#include <unordered_map>
+#include <sys/types.h>
+#else
+#define COOPTASK_THREADLOCAL
+#endif
+
+class CoopScheduler;
+class CoopTaskBase;
+class CoopWaitList;
+
+/// The link of a task in the wakeup queue of a run queue, see CoopTaskBase::RunQueue.
+struct CoopTaskInboxLink
+{
+    std::atomic<CoopTaskInboxLink*> inboxNext { nullptr };
+};
+
+/// The links of a task in the list of tasks that wait on a CoopSemaphore, see CoopWaitList.
+struct CoopTaskWaitLink
 {
+    CoopTaskBase* waitPrev = nullptr;
+    CoopTaskBase* waitNext = nullptr;
+    // the list that the task is queued on, and the priority level that it is queued at
+    CoopWaitList* waitList = nullptr;
+    // the number of units that the task waits for, and whether it was woken up to take them
+    unsigned waitCount = 1;
+    uint8_t waitLevel = 0;
+    bool waitClaim = false;
+#if defined(COOPTASK_MULTITHREAD)
+    // the next task that a waker schedules after releasing the wait lock, and whether it has yet to do so
+    CoopTaskBase* wakeNext = nullptr;
+    std::atomic<bool> waking { false };
+#endif
+};
+
+class CoopTaskBase : protected CoopTaskInboxLink, protected CoopTaskWaitLink
+{
+protected:
+    struct RunQueue;
+#if defined(COOPTASK_REACTOR)
+    // a file operation of a task, kept by the task until it completes
+    struct FileOp;
+#endif
+
 public:
     static constexpr bool FULLFEATURES = sizeof(unsigned) >= 4;
+    /// The number of priority levels of tasks, 0 is the lowest, and the default.
+    static constexpr uint8_t PRIORITYLEVELS = 4;
+    /// The maximum number of higher-priority tasks that run in a row ahead of the remaining tasks of a scheduler pass.
+    static constexpr uint8_t PRIORITYAGING = 8;
+#ifndef ARDUINO
+    // host builds grow the registry on demand, vacated slots are reused
+    using runnabletasks_t = std::deque< std::atomic<CoopTaskBase* > >;
+    /// A monotonic clock in microseconds.
+    using clocksource_t = uint64_t(*)();
+#else
+    static constexpr size_t MAXNUMBERCOOPTASKS = FULLFEATURES ? 32 : 8;
+    // for lock-free insertion, must be one element larger than max task count
+    using runnabletasks_t = std::array< std::atomic<CoopTaskBase* >, MAXNUMBERCOOPTASKS + 1>;
+#endif
+#if !defined(_MSC_VER) && !defined(ESP32_FREERTOS)
+    /// A stack that many tasks run on in turn. Only the live part of each task's stack
+    /// is copied out when another task runs on it, and copied back before the task resumes.
+    struct SharedStack
+    {
+        CoopTaskBase* owner;
+#if defined(COOPTASK_MULTITHREAD)
+        // all tasks on a shared stack run on the same worker thread
+        size_t worker;
+        bool pinned;
+#endif
+    };
+#endif
 
 protected:
     using taskfunction_t = Delegate< void() >;
 
 #ifdef ARDUINO
-    CoopTaskBase(const String& name, taskfunction_t _func, size_t stackSize = DEFAULTTASKSTACKSIZE) :
+    CoopTaskBase(String name, taskfunction_t _func, size_t stackSize = DEFAULTTASKSTACKSIZE) :
 #else
-    CoopTaskBase(const std::string& name, taskfunction_t _func, size_t stackSize = DEFAULTTASKSTACKSIZE) :
+    CoopTaskBase(std::string name, taskfunction_t _func, size_t stackSize = DEFAULTTASKSTACKSIZE) :
 #endif
-        taskName(name), sleeps(true), delays(false), func(_func)
+        taskName(std::move(name)), scheduler(boundScheduler()), sleeps(true), delays(false), readyQueued(false), func(std::move(_func))
     {
         taskStackSize = (sizeof(unsigned) >= 4) ? ((stackSize + sizeof(unsigned) - 1) / sizeof(unsigned)) * sizeof(unsigned) : stackSize;
     }
@@ -101,22 +189,176 @@ protected:
     static void taskFunc(void* _self);
 #else
     char* taskStackTop = nullptr;
-    static jmp_buf env;
+    // bytes at the bottom of the stack that already hold STACKCOOKIE, initialize() fills only the rest
+    size_t taskStackPainted = 0;
+#if defined(__linux__) && !defined(ARDUINO)
+    // the stack is mapped above an inaccessible guard page, and holds no cookies
+    bool taskStackGuarded = false;
+    bool stackGuarded() const { return taskStackGuarded; }
+#else
+    static constexpr bool stackGuarded() { return false; }
+#endif
+#if defined(COOPTASK_ASMCONTEXT)
+    // the saved stack pointers, all other registers are saved on these stacks
+    static COOPTASK_THREADLOCAL void* env;
+    void* env_yield = nullptr;
+    int val = 0;
+    static void taskFunc(void* _self);
+#else
+    static COOPTASK_THREADLOCAL jmp_buf env;
     jmp_buf env_yield;
+    // the lowest address of the live stack when the task last yielded
+    char* liveStackBottom = nullptr;
+#endif
+    // A task on a shared stack keeps the live part of its stack in sharedStackSave,
+    // while another task owns the shared stack.
+    SharedStack* sharedStack = nullptr;
+    char* sharedStackSave = nullptr;
+    size_t sharedStackSaveSize = 0;
+    char* liveStack() const;
+    char* stackEnd() const { return taskStackTop + taskStackSize + (FULLFEATURES ? sizeof(STACKCOOKIE) : 0); }
+    /// Saves the live stack of the current owner of the shared stack, and restores this task's own.
+    void acquireSharedStack();
+#endif
+    static constexpr size_t NOINDEX = ~static_cast<size_t>(0);
+    // the scheduler that the task is bound to at creation, it keeps the task in its registry and run queue
+    CoopScheduler* const scheduler;
+    static CoopScheduler* boundScheduler();
+    // Intrusive ready queue. scheduleTask() pushes onto the inbox from any context, a wait-free
+    // multi-producer, single-consumer queue, whose producers pay one atomic exchange. It holds each task
+    // at most once. The scheduler moves the inbox in FIFO order onto the readyHead list of each task's priority,
+    // and each pass takes all tasks that are runnable at its beginning onto the passHead lists.
+    // A pass runs its tasks by priority, a task that becomes ready during the pass runs ahead
+    // of the remaining tasks of lower priority, up to PRIORITYAGING of these in a row.
+    struct RunQueue
+    {
+        RunQueue() : inboxBack(&inboxStub), inboxFront(&inboxStub)
+#if defined(COOPTASK_MULTITHREAD)
+            , passLength(0), stealRequest(nullptr), parked(false), unparks(0)
+#endif
+        {}
+        // the stub is queued behind the last task when that gets taken, producers link in behind inboxBack
+        CoopTaskInboxLink inboxStub;
+        std::atomic<CoopTaskInboxLink*> inboxBack;
+        CoopTaskInboxLink* inboxFront;
+        void IRAM_ATTR pushInbox(CoopTaskInboxLink* link);
+        /// @returns: the first task of the inbox, nullptr if it is empty, or the next task is still being linked in.
+        CoopTaskBase* popInbox();
+        bool inboxEmpty() const { return inboxFront == &inboxStub && inboxBack.load() == &inboxStub; }
+        CoopTaskBase* readyHead[PRIORITYLEVELS] = {};
+        CoopTaskBase* readyTail[PRIORITYLEVELS] = {};
+        CoopTaskBase* passHead[PRIORITYLEVELS] = {};
+        // the count of tasks that ran ahead of the pass since a task of the pass ran
+        uint8_t bypasses = 0;
+        void appendReady(CoopTaskBase* task);
+        bool hasReady() const;
+#ifndef ARDUINO
+        // Delayed tasks are kept in binary min-heaps ordered by their wakeup deadline,
+        // one for each time base, such that the scheduler only visits tasks whose delay has expired.
+        std::vector<CoopTaskBase*> delayedTasksMs;
+        std::vector<CoopTaskBase*> delayedTasksUs;
+        // while delayed tasks of a priority above 0 are waiting, the timers expire between the tasks of a pass
+        size_t prioritizedTimers = 0;
+#endif
+#if defined(COOPTASK_MULTITHREAD)
+        // the total lengths of the readyHead and passHead lists, the latter is published for idle workers
+        size_t readyLength = 0;
+        std::atomic<size_t> passLength;
+        // an idle worker asks for a share of the ready tasks, which are handed over between two tasks
+        std::atomic<RunQueue*> stealRequest;
+        // while idle, the scheduler thread blocks on the unparks futex, pushReady() wakes it up
+        std::atomic<bool> parked;
+        std::atomic<uint32_t> unparks;
+        /// Blocks the calling thread until a task is pushed onto the inbox, or the timeout expires.
+        /// While tasks wait for file descriptors, it blocks in epoll_wait and wakes them up.
+        /// @param ms the timeout, ending on a millisecond boundary of millis(). ~0U blocks without timeout.
+        void park(uint32_t ms);
+        void IRAM_ATTR unpark();
+#endif
+#if defined(COOPTASK_REACTOR)
+        ~RunQueue();
+        // the tasks that wait for each file descriptor to become readable or writable
+        struct IoWatch
+        {
+            CoopTaskBase* reader = nullptr;
+            CoopTaskBase* writer = nullptr;
+        };
+        std::unordered_map<int, IoWatch> ioWatches;
+        size_t ioWaits = 0;
+        // created on first use, wakeFd is an eventfd that unpark() signals while parked in epoll_wait
+        int epollFd = -1;
+        int wakeFd = -1;
+        std::atomic<bool> parkedIo { false };
+        bool watchIo(int fd, bool read, CoopTaskBase* task);
+        void unwatchIo(int fd, bool read);
+        bool updateIo(int fd, const IoWatch& watch, int op);
+        bool openIo();
+        /// Submits the file operations of the tasks, wakes up the tasks whose file descriptors
+        /// have become ready, and those whose file operations have completed.
+        /// @param timeout_ms the timeout of epoll_wait, 0 returns immediately, -1 blocks without timeout.
+        void pollIo(int timeout_ms);
+        // the io_uring of the file operations, set up on their first use, which signals wakeFd on completions
+        struct FileRing;
+        FileRing* fileRing = nullptr;
+        bool fileRingTried = false;
+        bool submitFile(FileOp* op);
+        void reapFiles();
+#endif
+    };
+#if defined(COOPTASK_MULTITHREAD)
+    // the worker run queue that wakeups of this task go to, assigned when it is first queued on a worker
+    RunQueue* homeQueue = nullptr;
+    /// Picks the worker run queue for a task that is queued for the first time.
+    RunQueue* IRAM_ATTR assignQueue();
+    /// Pushes the task, which must be marked as queued, onto the inbox of the run queue and wakes its worker.
+    void IRAM_ATTR pushReady(RunQueue& target);
+    /// Hands every second ready task over to an idle worker that has asked for work.
+    static void shareReadyTasks(RunQueue& rq);
+#endif
+    /// @returns: the run queue of the task, on its scheduler or the worker it is assigned to.
+    inline RunQueue& home();
+    // the task that was switched to directly, from the task that the scheduler has run
+    static COOPTASK_THREADLOCAL CoopTaskBase* handoffTask;
+    static COOPTASK_THREADLOCAL CoopTaskBase* current;
+#ifndef ARDUINO
+    size_t timerIndex = NOINDEX;
+    uint32_t timerDeadline = 0;
+    bool timerIsMs = false;
+    bool timerPrioritized = false;
+#endif
+    uint8_t priority = 0;
+    bool hasDeadline = false;
+    uint32_t deadline = 0;
+    bool deadlineBefore(const CoopTaskBase& other) const { return static_cast<int32_t>(deadline - other.deadline) < 0; }
+#if defined(COOPTASK_REACTOR)
+    // set by the reactor when it wakes up the task for the file descriptor it waits for
+    bool ioReady = false;
+    bool ioWaiting = false;
+    bool waitIo(int fd, bool read, uint32_t ms) noexcept;
+    // not on the task's stack, which may be a shared stack that other tasks run on meanwhile
+    FileOp* fileOp = nullptr;
+    static ssize_t fileIo(uint8_t opcode, int fd, void* buf, size_t count, off_t offset) noexcept;
+    static void completeFile(FileOp* op, ssize_t result);
 #endif
-    static constexpr size_t MAXNUMBERCOOPTASKS = FULLFEATURES ? 32 : 8;
-    // for lock-free insertion, must be one element larger than max task count
-    static std::array< std::atomic<CoopTaskBase* >, MAXNUMBERCOOPTASKS + 1> runnableTasks;
-    static std::atomic<size_t> runnableTasksCount;
-    static CoopTaskBase* current;
     bool init = false;
     bool cont = true;
     std::atomic<bool> sleeps;
     // ESP32 FreeRTOS (#define ESP32_FREERTOS) handles delays, on this platfrom delays is always false
     std::atomic<bool> delays;
+    // true while the task is in the ready queue, or being run by the scheduler
+    std::atomic<bool> readyQueued;
+    CoopTaskBase* readyNext = nullptr;
+    size_t runnableIndex = NOINDEX;
 
     int32_t initialize();
+    /// Calls the task function. A task type that keeps its function by the concrete type overrides this.
+    virtual void invokeTask() { func(); }
     void doYield(unsigned val) noexcept;
+#if !defined(_MSC_VER) && !defined(ESP32_FREERTOS)
+    /// Evaluates the state of a task that has returned control to the scheduler.
+    int32_t afterYield(int val);
+    void _handoff(CoopTaskBase* task) noexcept;
+#endif
 
 #if defined(ESP8266)
     static bool usingBuiltinScheduler;
@@ -124,12 +366,42 @@ protected:
 #endif
     bool IRAM_ATTR enrollRunnable();
     void delistRunnable();
+    void IRAM_ATTR enqueueReady();
+    /// After run(), puts the task back into the ready queue, or on host builds, into the timer queue.
+    /// A sleeping or exited task leaves the ready queue.
+    void requeue(int32_t runResult);
+    void unlinkReady();
+    static void takeReadyInbox(RunQueue& rq);
+    static void beginPass(RunQueue& rq);
+    /// @returns: the next task to run in the pass by priority, nullptr at the end of the pass.
+    static CoopTaskBase* nextPassTask(RunQueue& rq);
 
     void _exit() noexcept;
     void _yield() noexcept;
     void _sleep() noexcept;
     void _delay(uint32_t ms) noexcept;
     void _delayMicroseconds(uint32_t us) noexcept;
+    void _delayUntil(uint32_t ms) noexcept;
+
+#ifndef ARDUINO
+    void insertTimer();
+    void removeTimer();
+    static void siftTimer(std::vector<CoopTaskBase*>& timers, size_t pos);
+    static clocksource_t clockSource;
+    // the clock is read once at the beginning of each scheduler pass
+    static COOPTASK_THREADLOCAL uint64_t passClock;
+    static COOPTASK_THREADLOCAL bool passClockValid;
+    /// Moves all tasks whose deadline has expired from the timer queues into the ready queue.
+    static void expireTimers(RunQueue& rq);
+    /// @returns: true if the ready queue holds a task that is runnable, tasks that stay in it
+    /// until a delay below DELAYMICROS_THRESHOLD microseconds expires do not count.
+    static bool hasRunnableReady(const RunQueue& rq);
+    /// Spins until the clock reaches deadline, or a task gets scheduled from another thread.
+    static void spinUntil(const RunQueue& rq, uint64_t deadline);
+    /// @returns: the remaining delay in milliseconds until the earliest deadline of all
+    /// delayed tasks, ~0U if the timer queues are empty.
+    static uint32_t nextTimerDelay(const RunQueue& rq);
+#endif
 
 private:
     // true: delay_start/delay_duration are in milliseconds; false: delay_start/delay_duration are in microseconds.
@@ -139,6 +411,9 @@ private:
 
     taskfunction_t func;
 
+    friend class CoopScheduler;
+    friend class CoopWaitList;
+
 public:
     virtual ~CoopTaskBase();
 #if defined(ESP32)
@@ -193,17 +468,23 @@ public:
         usingBuiltinScheduler = state;
     }
 #endif
-    /// Every task is entered into this list by scheduleTask(). It is removed when it exits
-    /// or gets deleted.
-    static const decltype(runnableTasks)& getRunnableTasks()
-    {
-        return runnableTasks;
-    }
+    /// Every task is entered into this list of its scheduler by scheduleTask(). It is removed when it exits
+    /// or gets deleted. The scheduler itself only visits the tasks in the ready queue.
+    /// @returns: the list of CoopScheduler::current().
+    static const runnabletasks_t& getRunnableTasks();
     /// @returns: the count of runnable, non-nullptr, tasks in the return of getRunnableTasks().
-    static size_t getRunnableTasksCount()
-    {
-        return runnableTasksCount.load();
-    }
+    static size_t getRunnableTasksCount();
+
+#ifndef ARDUINO
+    /// Replaces the clock that delays and timeouts are measured by, before any task is delayed.
+    /// By default, it is CLOCK_MONOTONIC on Linux, otherwise std::chrono::steady_clock.
+    static void setClockSource(clocksource_t source) { clockSource = source; }
+    /// @returns: the current time of the clock source in microseconds.
+    static uint64_t clockNow() { return clockSource(); }
+    /// @returns: during a scheduler pass on the calling thread, the time in microseconds at its beginning,
+    /// otherwise the current time.
+    static uint64_t passTime() { return passClockValid ? passClock : clockSource(); }
+#endif
 
     /// @returns: -1: exited. 0: runnable or sleeping. >0: delayed for milliseconds or microseconds, check delayIsMs().
     int32_t run();
@@ -213,13 +494,30 @@ public:
 
     bool delayIsMs() const noexcept { return delay_ms; }
 
+    /// Sets the priority level of the task, from 0 to PRIORITYLEVELS - 1, higher levels run first.
+    /// A task that is queued to run takes the new priority the next time it is queued.
+    void setPriority(uint8_t level) noexcept { priority = level < PRIORITYLEVELS ? level : PRIORITYLEVELS - 1; }
+    /// @returns: the priority level of the task.
+    uint8_t getPriority() const noexcept { return priority; }
+    /// Declares the absolute deadline of the task, in milliseconds of the clock of delayUntil().
+    /// If its scheduler has earliest-deadline-first ordering enabled, the ready tasks of the same
+    /// priority run in the order of their deadlines, ahead of those without a deadline.
+    /// A task that is queued to run takes the new deadline the next time it is queued.
+    void setDeadline(uint32_t ms) noexcept { deadline = ms; hasDeadline = true; }
+    void clearDeadline() noexcept { hasDeadline = false; }
+    /// @returns: the deadline of the task, if it has one, see setDeadline().
+    bool getDeadline(uint32_t& ms) const noexcept { ms = deadline; return hasDeadline; }
+
     /// Modifies the sleep flag. if called from a running task, it is not immediately suspended.
     /// @param state true: a suspended task becomes sleeping, if call from the running task,
     /// the next call to yield() or delay() puts it into sleeping state.
     /// false: clears the sleeping and delay state of the task.
     void IRAM_ATTR sleep(const bool state) noexcept;
+    /// Like sleep(true), but the task also wakes up when ms milliseconds have expired. Call from the running task,
+    /// the next call to yield() suspends it until then, unless it is woken up before, which sleep(false) does.
+    void IRAM_ATTR timedSleep(uint32_t ms) noexcept;
 
-#ifdef ESP32_FREERTOS
+#if defined(ESP32_FREERTOS) || defined(COOPTASK_MULTITHREAD)
     /// @returns: a pointer to the CoopTask instance that is running. nullptr if not called from a CoopTask function (running() == false).
     static CoopTaskBase* self() noexcept;
 #else
@@ -248,7 +546,45 @@ public:
     static void delay(uint32_t ms) noexcept { self()->_delay(ms); }
     static void delay(CoopTaskBase* self, uint32_t ms) noexcept { self->_delay(ms); }
     /// use only in running CoopTask function.
+    /// Delays the task until the absolute deadline, in milliseconds of millis() on Arduino,
+    /// or of clockNow() / 1000 on the host OSs. Periodic tasks that advance the deadline
+    /// by their period do not drift by their own run time. A deadline that has passed yields.
+    static void delayUntil(uint32_t ms) noexcept { self()->_delayUntil(ms); }
+    /// use only in running CoopTask function.
     static void delayMicroseconds(uint32_t us) noexcept { self()->_delayMicroseconds(us); }
+#if defined(COOPTASK_REACTOR)
+    /// use only in running CoopTask function.
+    /// Suspends the task until the file descriptor becomes readable, or the timeout expires.
+    /// On a scheduler or worker, one task at a time may wait for a file descriptor to become readable,
+    /// and one to become writable.
+    /// @param ms the timeout in milliseconds, ~0U waits without timeout.
+    /// @returns: true if fd is readable, or has an error or hangup pending. false on timeout, if the
+    /// task was woken up otherwise, or if the file descriptor could not be watched.
+    static bool waitReadable(int fd, uint32_t ms = ~0U) noexcept { return self()->waitIo(fd, true, ms); }
+    /// use only in running CoopTask function.
+    /// Like waitReadable(), but for fd to become writable.
+    static bool waitWritable(int fd, uint32_t ms = ~0U) noexcept { return self()->waitIo(fd, false, ms); }
+    /// Reads from fd like pread(), or like read() at the file position if offset is -1, without blocking
+    /// other tasks. The running task is suspended until the operation completes. The operations of a pass are
+    /// submitted to io_uring together, if it is not available, they are performed on a pool of threads.
+    /// Outside of a running CoopTask function, it performs the operation synchronously.
+    /// Tasks on a shared stack should not pass buffers on their stack, as other tasks use the shared stack
+    /// while the operation is in progress. Such a buffer is copied through a heap buffer of the task.
+    /// @returns: the count of bytes read, or -1 and errno is set.
+    static ssize_t coopRead(int fd, void* buf, size_t count, off_t offset = -1) noexcept;
+    /// Writes to fd like pwrite(), or like write() at the file position if offset is -1, see coopRead().
+    /// @returns: the count of bytes written, or -1 and errno is set.
+    static ssize_t coopWrite(int fd, const void* buf, size_t count, off_t offset = -1) noexcept;
+    /// Flushes fd to storage like fsync(), see coopRead().
+    /// @returns: 0, or -1 and errno is set.
+    static int coopFsync(int fd) noexcept;
+#endif
+#if !defined(_MSC_VER) && !defined(ESP32_FREERTOS)
+    /// use only in running CoopTask function, scheduled by runCoopTasks().
+    /// Wakes up the given task. If it is suspended and not queued to run yet, the running task
+    /// yields and the CPU switches directly to the woken task, without returning to the scheduler first.
+    static void handoff(CoopTaskBase* task) noexcept { self()->_handoff(task); }
+#endif
 };
 
 #ifndef ARDUINO
@@ -257,6 +593,7 @@ inline void delay(uint32_t ms) { CoopTaskBase::delay(ms); }
 #endif
 
 /// An optional convenience funtion that does all the work to cyclically perform CoopTask execution.
+/// It runs one pass of the default CoopScheduler, see CoopScheduler::run().
 /// @param reaper An optional function that is called once when a task exits.
 /// @param onDelay An optional function to handle a global delay greater or equal 1 millisecond, resulting
 /// from the minimum time interval for which at this time all CoopTasks are delayed.
@@ -268,7 +605,15 @@ inline void delay(uint32_t ms) { CoopTaskBase::delay(ms); }
 /// This can be used for power saving modes.
 /// onSleep(), like onDelay(), must return a bool value, if true, runCoopTasks performs the
 /// default housekeeping actions, otherwise it skips those.
+/// On Linux, if CoopScheduler::setIdleBlocking() is enabled for the default scheduler, the default
+/// housekeeping blocks the calling thread while all CoopTasks are delayed or sleeping, otherwise
+/// runCoopTasks returns after each pass.
 void runCoopTasks(const Delegate<void(const CoopTaskBase* const task)>& reaper = nullptr,
     const Delegate<bool(uint32_t ms)>& onDelay = nullptr, const Delegate<bool()>& onSleep = nullptr);
 
+#if defined(COOPTASK_MULTITHREAD)
+/// Runs the CoopTasks of the default CoopScheduler on a pool of worker threads, see CoopScheduler::runOnWorkers().
+void runCoopTasksOnWorkers(const Delegate<void(const CoopTaskBase* const task)>& reaper = nullptr, unsigned workers = 0);
+#endif
+
 #endif // __CoopTaskBase_h